@@ -10,14 +10,17 @@
 #include <iterator>
 #include "spdlog/spdlog.h"
 #include <thread>
+#include <chrono>
 #include <unistd.h>
 #include <condition_variable>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <string.h>
 #include <cassert>
 #include "fabric.h"
-
-#ifndef GTEST
-#include "umfpack.h"
-#endif
+#include "solver.h"
+#include "kernels.h"
 
 using namespace std; 
 
@@ -42,9 +45,296 @@ void circuit_next_step() {
 
 enum input_read_state {
     SECTION_1,
-    SECTION_2
+    SECTION_2,
+    SECTION_3   // optional: cell areas
+};
+
+// whitespace separated integer tokens, read in place from a mapped file
+struct token_reader {
+    const char* p;
+    const char* end;
+    const char* tok;
+    const char* tok_end;
+    long val;
+    bool bad;
+    bool bol;   // the current token is the first on its line
+
+    token_reader(const char* b, const char* e) : p(b), end(e), tok(b), tok_end(b), val(0), bad(false), bol(true) {}
+
+    // skips to the next token; false at the end of the input
+    bool skip_space() {
+        bol = (p == tok);   // only true before the first token
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')) {
+            if (*p == '\n')
+                bol = true;
+            ++p;
+        }
+        return p != end;
+    }
+
+    // false at the end of the input or on anything that isn't an integer
+    bool next() {
+        if (!skip_space())
+            return false;
+
+        tok = p;
+        bool neg = (*p == '-');
+        if (neg)
+            ++p;
+        if (p == end || *p < '0' || *p > '9') {
+            bad = true;
+            return false;
+        }
+        val = 0;
+        while (p < end && *p >= '0' && *p <= '9') {
+            val = val*10 + (*p - '0');
+            ++p;
+        }
+        if (p < end && !(*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')) {
+            bad = true;
+            return false;
+        }
+        tok_end = p;
+        if (neg)
+            val = -val;
+        return true;
+    }
+
+    // the next token as a non-negative decimal number, e.g. 2 or 0.75
+    bool next_number(double* num) {
+        if (!skip_space())
+            return false;
+
+        tok = p;
+        double v = 0., scale = 1.;
+        bool frac = false, digits = false;
+        for (; p < end && ((*p >= '0' && *p <= '9') || (*p == '.' && !frac)); ++p) {
+            if (*p == '.') {
+                frac = true;
+                continue;
+            }
+            digits = true;
+            if (frac)
+                v += (*p - '0') * (scale /= 10.);
+            else
+                v = v*10. + (*p - '0');
+        }
+        if (!digits || (p < end && !(*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n'))) {
+            bad = true;
+            return false;
+        }
+        tok_end = p;
+        *num = v;
+        return true;
+    }
+
+    string label() { return string(tok, tok_end); }
 };
 
+// every pin is a token of its own, so this bounds the pin count. a
+// separate pass over the mapped bytes is cheaper than growing the pin list
+static size_t count_tokens(const char* p, const char* end) {
+    size_t n = 0;
+    bool in_tok = false;
+    for (; p < end; ++p) {
+        bool space = (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n');
+        if (!space && !in_tok)
+            ++n;
+        in_tok = !space;
+    }
+    return n;
+}
+
+// labels in the input are integers, so ids are found through a table
+// indexed by value. a label string is only made the first time a cell or
+// net is seen, for the netlist side tables
+static const long MAX_DIRECT_LABEL = 1L << 24;
+
+static int find_or_add_id(vector<int>& by_value, token_reader& t, netlist& nl, bool is_cell) {
+    if (t.val >= 0 && t.val < MAX_DIRECT_LABEL) {
+        if (t.val >= (long)by_value.size())
+            by_value.resize(max((long)by_value.size()*2, t.val+1), -1);
+        int& id = by_value[t.val];
+        if (id < 0)
+            id = is_cell ? nl.add_cell(t.label()) : nl.add_net(t.label());
+        return id;
+    }
+    return is_cell ? nl.add_cell(t.label()) : nl.add_net(t.label());
+}
+
+static int find_cell_id(vector<int>& by_value, token_reader& t, netlist& nl) {
+    if (t.val >= 0 && t.val < (long)by_value.size())
+        return by_value[t.val];
+    auto it = nl.cell_ids.find(t.label());
+    return (it == nl.cell_ids.end()) ? -1 : it->second;
+}
+
+/****
+*
+* binary netlist file
+*
+* header, then in native byte order:
+*   double   x[n_cells], y[n_cells]      fixed cell coordinates
+*   int32    cell_ptr[n_cells+1], cell_nets[n_pins]
+*   int32    net_ptr[n_nets+1], net_cells[n_pins]
+*   int32    cell_label_ptr[n_cells+1], net_label_ptr[n_nets+1]
+*   uint8    fixed[n_cells]
+*   char     labels[label_bytes]
+* the checksum is FNV-1a over everything after the header
+*
+****/
+
+static uint64_t fnv1a(const char* p, size_t n) {
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < n; ++i) {
+        h ^= (unsigned char)p[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+template<typename T>
+static void append_array(string& out, const T* p, size_t n) {
+    out.append((const char*)p, n*sizeof(T));
+}
+
+template<typename T>
+static const char* read_array(vector<T>& dst, const char* p, size_t n) {
+    dst.assign((const T*)p, (const T*)p + n);
+    return p + n*sizeof(T);
+}
+
+static size_t binary_payload_size(const netlist_file_header* h) {
+    return 3*sizeof(double)*h->n_cells
+        + sizeof(int32_t)*(2*(size_t)h->n_cells + 2*(size_t)h->n_nets + 2*(size_t)h->n_pins + 4)
+        + h->n_cells + h->label_bytes;
+}
+
+bool circuit::write_binary(string file) {
+    netlist* nl = get_netlist();
+    int ncells = nl->n_cells();
+    int nnets = nl->n_nets();
+
+    vector<double> xs(ncells), ys(ncells), areas(ncells);
+    vector<uint8_t> fixed(ncells);
+    for (int i = 0; i < ncells; ++i) {
+        pair<double,double> coords = cells[i]->get_coords();
+        xs[i] = get<0>(coords);
+        ys[i] = get<1>(coords);
+        areas[i] = cells[i]->get_area();
+        fixed[i] = cells[i]->is_fixed();
+    }
+
+    string labels;
+    vector<int32_t> cell_label_ptr(1, 0);
+    for (auto& l : nl->cell_labels) {
+        labels += l;
+        cell_label_ptr.push_back(labels.size());
+    }
+    vector<int32_t> net_label_ptr(1, labels.size());
+    for (auto& l : nl->net_labels) {
+        labels += l;
+        net_label_ptr.push_back(labels.size());
+    }
+
+    string payload;
+    append_array(payload, xs.data(), ncells);
+    append_array(payload, ys.data(), ncells);
+    append_array(payload, areas.data(), ncells);
+    append_array(payload, nl->cell_ptr.data(), ncells+1);
+    append_array(payload, nl->cell_nets.data(), nl->cell_nets.size());
+    append_array(payload, nl->net_ptr.data(), nnets+1);
+    append_array(payload, nl->net_cells.data(), nl->net_cells.size());
+    append_array(payload, cell_label_ptr.data(), ncells+1);
+    append_array(payload, net_label_ptr.data(), nnets+1);
+    append_array(payload, fixed.data(), ncells);
+    payload += labels;
+
+    netlist_file_header h;
+    memcpy(h.magic, NETLIST_FILE_MAGIC, 4);
+    h.version = NETLIST_FILE_VERSION;
+    h.n_cells = ncells;
+    h.n_nets = nnets;
+    h.n_pins = nl->cell_nets.size();
+    h.label_bytes = labels.size();
+    h.checksum = fnv1a(payload.data(), payload.size());
+    assert(binary_payload_size(&h) == payload.size());
+
+    ofstream out(file, ios::binary);
+    if (!out.is_open()) {
+        spdlog::error("Could not open {} for writing", file);
+        return false;
+    }
+    out.write((const char*)&h, sizeof(h));
+    out.write(payload.data(), payload.size());
+    out.close();
+    spdlog::info("Wrote {}: {} cells, {} nets, {} pins", file, ncells, nnets, h.n_pins);
+    return !out.fail();
+}
+
+// the arrays are copied out of the mapped file as they are, only the
+// label side tables and the cell/net objects are built element by element
+bool circuit::read_netlist_binary(string file, const char* data, size_t size) {
+    netlist_file_header h;
+    memcpy(&h, data, sizeof(h));
+    if (h.version != NETLIST_FILE_VERSION) {
+        spdlog::error("{}: unsupported netlist file version {}, recompile it with --compile-netlist", file, h.version);
+        return false;
+    }
+    const char* p = data + sizeof(h);
+    if (size - sizeof(h) != binary_payload_size(&h)) {
+        spdlog::error("{}: truncated netlist file", file);
+        return false;
+    }
+    if (fnv1a(p, size - sizeof(h)) != h.checksum) {
+        spdlog::error("{}: netlist file checksum mismatch", file);
+        return false;
+    }
+
+    int ncells = h.n_cells;
+    int nnets = h.n_nets;
+    vector<double> xs, ys, areas;
+    vector<int32_t> cell_label_ptr, net_label_ptr;
+    vector<uint8_t> fixed;
+    p = read_array(xs, p, ncells);
+    p = read_array(ys, p, ncells);
+    p = read_array(areas, p, ncells);
+    p = read_array(nl.cell_ptr, p, ncells+1);
+    p = read_array(nl.cell_nets, p, h.n_pins);
+    p = read_array(nl.net_ptr, p, nnets+1);
+    p = read_array(nl.net_cells, p, h.n_pins);
+    p = read_array(cell_label_ptr, p, ncells+1);
+    p = read_array(net_label_ptr, p, nnets+1);
+    p = read_array(fixed, p, ncells);
+
+    nl.cell_labels.resize(ncells);
+    nl.net_labels.resize(nnets);
+    for (int i = 0; i < ncells; ++i) {
+        nl.cell_labels[i].assign(p + cell_label_ptr[i], cell_label_ptr[i+1] - cell_label_ptr[i]);
+        nl.cell_ids[nl.cell_labels[i]] = i;
+    }
+    for (int i = 0; i < nnets; ++i) {
+        nl.net_labels[i].assign(p + net_label_ptr[i], net_label_ptr[i+1] - net_label_ptr[i]);
+        nl.net_ids[nl.net_labels[i]] = i;
+    }
+
+    // keep the pin list in step so later additions rebuild correctly
+    nl.pins.resize(h.n_pins);
+    for (int c = 0; c < ncells; ++c) {
+        for (int k = nl.cell_ptr[c]; k < nl.cell_ptr[c+1]; ++k)
+            nl.pins[k] = make_pair(c, nl.cell_nets[k]);
+    }
+    nl.dirty = false;
+
+    for (int i = 0; i < ncells; ++i) {
+        cells.push_back(new cell(&nl, i));
+        cells[i]->set_area(areas[i]);
+        if (fixed[i])
+            cells[i]->set_coords(xs[i], ys[i], true);
+    }
+    return true;
+}
+
 /****
 *
 * circuit class functions
@@ -52,77 +342,173 @@ enum input_read_state {
 ****/
 
 circuit::circuit(string file) {
-    string line;
-    ifstream infile (file);
-    spdlog::debug("Reading input file {}", file);
     fixed_weight_bias = 0;
+    Q = nullptr;
+    base_valid = false;
+    base_pins = 0;
+    slv = new umfpack_solver();
+    parallel_axes = true;
+    model = CLIQUE;
+    star_fanout = 0;
+    placed = false;
+    Qb2b[0] = Qb2b[1] = nullptr;
+    total_hpwl = 0.;
+    box_moves = 0;
+    box_pins = 0;
+
+    read_netlist(file);
+    get_netlist();
+}
+
+// the file is mapped and tokenized in place: pins go straight into the
+// netlist pin list and no per-line strings are built
+void circuit::read_netlist(string file) {
+    spdlog::debug("Reading input file {}", file);
+    auto t0 = chrono::steady_clock::now();
 
-    if (infile.is_open()) {
-
-        enum input_read_state read_state = SECTION_1;
-
-        bool done = false;
-        while (!done) {
-            getline(infile, line);
-            std::stringstream ss(line);
-            istream_iterator<std::string> begin(ss);
-            istream_iterator<std::string> end;
-            vector<string> vstrings(begin, end);
-            switch(read_state) {
-                case SECTION_1:
-                    if (vstrings[0] == "-1") {
-                        read_state = SECTION_2;
-                        break;
-                    }
-                    add_cell_connections(vstrings);
+    int fd = open(file.c_str(), O_RDONLY);
+    if (fd < 0) {
+        spdlog::error("Could not open {}", file);
+        return;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        spdlog::error("Could not read {}", file);
+        close(fd);
+        return;
+    }
+    size_t size = st.st_size;
+    void* data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        spdlog::error("Could not map {}", file);
+        return;
+    }
+
+    const char* b = (const char*)data;
+    if (size >= sizeof(netlist_file_header) && memcmp(b, NETLIST_FILE_MAGIC, 4) == 0) {
+        bool ok = read_netlist_binary(file, b, size);
+        munmap(data, size);
+        double secs = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+        if (ok)
+            spdlog::info("Loaded {}: {} cells, {} pins in {:.3f} ms", file, cells.size(), nl.cell_nets.size(), secs*1000.);
+        return;
+    }
 
+    token_reader t(b, b + size);
+    nl.pins.reserve(nl.pins.size() + count_tokens(b, b + size));
+
+    vector<int> cell_by_value;
+    vector<int> net_by_value;
+    enum input_read_state read_state = SECTION_1;
+    bool done = false;      // past the fixed cell section
+    bool stop = false;
+    while (!stop && t.next()) {
+        switch(read_state) {
+            case SECTION_1: {
+                if (t.val == -1) {
+                    read_state = SECTION_2;
                     break;
-                case SECTION_2:
-                    if (vstrings[0] == "-1") {
-                        done = true;
-                        break;
-                    }
-                    add_cell_fixed_coords(vstrings);
+                }
+                int id = find_or_add_id(cell_by_value, t, nl, true);
+                if (id == (int)cells.size())
+                    cells.push_back(new cell(&nl, id));
+                while (t.next() && t.val != -1) {
+                    nl.add_pin(id, find_or_add_id(net_by_value, t, nl, false));
+                }
+                break;
+            }
+            case SECTION_2: {
+                if (t.val == -1 && !t.bol)
+                    break;      // some files end fixed cell lines with -1 too
+                if (t.val == -1) {
+                    read_state = SECTION_3;
+                    done = true;
+                    break;
+                }
+                int id = find_cell_id(cell_by_value, t, nl);
+                string label = t.label();
+                long x = 0, y = 0;
+                if (t.next())
+                    x = t.val;
+                if (t.next())
+                    y = t.val;
+                if (id >= 0)
+                    cells[id]->set_coords(x, y, true);
+                else
+                    spdlog::error("Fixed coordinates for unknown cell {}", label);
+                break;
+            }
+            case SECTION_3: {
+                // cells not listed keep unit area
+                if (t.val == -1 && !t.bol)
+                    break;
+                if (t.val == -1) {
+                    stop = true;
                     break;
+                }
+                int id = find_cell_id(cell_by_value, t, nl);
+                string label = t.label();
+                double area;
+                if (!t.next_number(&area))
+                    break;
+                if (id >= 0)
+                    cells[id]->set_area(area);
+                else
+                    spdlog::error("Area for unknown cell {}", label);
+                break;
             }
         }
-        infile.close();
-    } else {
-        spdlog::error("Could not open {}", file);
+        if (t.bad)
+            break;
+    }
+    if (t.bad)
+        spdlog::error("Malformed input in {} at byte {}", file, t.p - b);
+    else if (!done)
+        spdlog::warn("{} ended before the end of the fixed cell section", file);
+
+    munmap(data, size);
+
+    double secs = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+    double mb = size / (1024.*1024.);
+    spdlog::info("Read {}: {} cells, {} pins, {:.2f} MB in {:.3f} ms ({:.1f} MB/s)",
+        file, cells.size(), nl.pins.size(), mb, secs*1000., secs > 0 ? mb/secs : 0.);
+}
+
+// pins are appended while reading, so the CSR arrays (and the net objects
+// wrapping them) are brought up to date here before anything reads them
+netlist* circuit::get_netlist() {
+    nl.build();
+    while ((int)nets.size() < nl.n_nets()) {
+        nets.push_back(new net(&nl, nets.size()));
     }
+    return &nl;
 }
 
 net* circuit::get_net(string label) {
-    //net n(label);
-    //auto it = nets.find(n);
-    //return &n;
-    return nets[label];
+    get_netlist();
+    auto it = nl.net_ids.find(label);
+    if (it == nl.net_ids.end())
+        return nullptr;
+    return nets[it->second];
 }
 
 bool circuit::fit(bool interactive) {
     return true;
 }
 
-void circuit::add_net(string s) {
-    net* n = new net(s);
-    if (nets.find(s) == nets.end()) {
-        nets[s] = n;
-    } else {
-        delete(n);
-    }
+int circuit::add_net(string s) {
+    return nl.add_net(s);
 }
 
 void circuit::add_cell_connections(vector<string> toks) {
-    cell* c = new cell(toks);
-    cells.push_back(c);
+    int id = nl.add_cell(toks[0]);
+    if (id == (int)cells.size())
+        cells.push_back(new cell(&nl, id));
 
-    vector<string> s_nets = std::vector<string>(toks.begin()+1,toks.end()-1);
-    for(string net : s_nets) {
-        add_net(net);
-        c->add_net(net);
-        nets[net]->add_cell(*c);
+    for(auto it = toks.begin()+1; it != toks.end()-1; ++it) {
+        nl.add_pin(id, add_net(*it));
     }
-
 }
 
 void circuit::add_cell_fixed_coords(vector<string> s) {
@@ -130,98 +516,260 @@ void circuit::add_cell_fixed_coords(vector<string> s) {
     int x = stoi(s[1]);
     int y = stoi(s[2]);
     c->set_coords(x,y,true);
-    fixed_cell_labels.insert(s[0]);
 }
 
 cell* circuit::get_cell(string label) {
-    for (auto b : cells) {
-        if (b->label == label) {
-            return b;
-        }
+    auto it = nl.cell_ids.find(label);
+    if (it == nl.cell_ids.end())
+        return nullptr;
+    return cells[it->second];
+}
+
+// the fixed cell part of the RHS, anchors are added by apply_spread_anchors
+void circuit::build_solver_rhs() {
+    // build the CSR arrays and nets now: the axis threads only read them
+    get_netlist();
+    base_Cx.assign(Q->n, 0.);
+    base_Cy.assign(Q->n, 0.);
+
+    if (parallel_axes) {
+        thread tx(&circuit::build_solver_rhs_axis, this, X, &base_Cx[0]);
+        build_solver_rhs_axis(Y, &base_Cy[0]);
+        tx.join();
+    } else {
+        build_solver_rhs_axis(X, &base_Cx[0]);
+        build_solver_rhs_axis(Y, &base_Cy[0]);
+    }
+    Q->Cx = base_Cx;
+    Q->Cy = base_Cy;
+
+    base_fixed.clear();
+    for (auto* c : cells) {
+        if (c->is_fixed())
+            base_fixed.push_back(c->get_coords());
     }
-    return nullptr;
 }
 
-void circuit::build_solver_rhs(fabric* fab) {
+// only reads the circuit, so both axes can be built at once. the netlist
+// has to be built already, see build_solver_rhs
+void circuit::build_solver_rhs_axis(enum axis ax, double* C) {
+    assert(!nl.dirty);
+    int i = 0;
     for(auto& c : cells) {
         if (c->is_fixed())
             continue;
-        double xval=0., yval=0.;
+        double val=0.;
         if (connects_to_fixed_cell(c)) {
             vector<cell*> others = get_connected_fixed_cells(c);
             for (auto& other : others) {
                 pair<double,double> coords = other->get_coords();
-                xval += (fixed_weight_bias + get_clique_weight(c,other))*get<0>(coords);   // w_i,z * x_z
-                yval += (fixed_weight_bias + get_clique_weight(c,other))*get<1>(coords);   // w_i,z * y_z
+                double z = (ax == X) ? get<0>(coords) : get<1>(coords);
+                // the bias goes on every net the two share, as on the diagonal
+                double w = 0.;
+                for (int n : nl.mutual_nets(c->id, other->id)) {
+                    if (!is_star_net(n))
+                        w += nets[n]->get_weight() + fixed_weight_bias;
+                }
+                val += w*z;   // w_i,z * x_z
 
                 if (fixed_weight_bias != 0) {
                     spdlog::debug("adding fixed weight to RHS cell: {} other: {}", c->label, other->label);
                 }
 
-                spdlog::debug("cell {} wiz {} xz {} yz {} ", c->label, get_clique_weight(c,other), get<0>(coords), get<1>(coords));
+                spdlog::debug("cell {} wiz {} z {} ", c->label, w, z);
             }
         } 
-
-        if (fab != nullptr) {
-            for(bin* b : fab->get_used_bins()) {
-                if (find(b->cells.begin(), b->cells.end(), c) != b->cells.end()) {
-                    spdlog::debug("found bin for cell @ {}, {}", b->x, b->y);
-                    xval += (double)(fab->spread_weight * b->x);
-                    yval += (double)(fab->spread_weight * b->y);
-                    break;
+        // the bias edges to star nets' fixed pins, see build_solver_matrix
+        if (fixed_weight_bias != 0) {
+            for (const int* n = nl.cell_nets_begin(c->id); n != nl.cell_nets_end(c->id); ++n) {
+                if (!is_star_net(*n))
+                    continue;
+                for (const int* o = nl.net_cells_begin(*n); o != nl.net_cells_end(*n); ++o) {
+                    if (!cells[*o]->is_fixed())
+                        continue;
+                    pair<double,double> coords = cells[*o]->get_coords();
+                    val += fixed_weight_bias * ((ax == X) ? get<0>(coords) : get<1>(coords));
                 }
             }
         }
 
-        Q->Cx.push_back(xval);
-        Q->Cy.push_back(yval);
+        C[i++] = val;
+    }
+
+    // star rows: the fixed pins of the net pull on its star variable
+    for (size_t k = 0; k < star_nets.size(); ++k) {
+        int n = star_nets[k];
+        double g = nl.n_pins(n) * nets[n]->get_weight();
+        double val = 0.;
+        for (const int* o = nl.net_cells_begin(n); o != nl.net_cells_end(n); ++o) {
+            if (!cells[*o]->is_fixed())
+                continue;
+            pair<double,double> coords = cells[*o]->get_coords();
+            double z = (ax == X) ? get<0>(coords) : get<1>(coords);
+            val += g*z;
+        }
+        C[movable_cells.size() + k] = val;
+    }
+}
+
+// Q holds the net connectivity only. spreading iterations change nothing
+// but the anchor weights, so the matrix and the fixed cell part of the RHS
+// are kept and only rebuilt when the netlist, the set of fixed cells or a
+// fixed cell's position changes
+bool circuit::solver_matrix_stale() {
+    if (Q == nullptr || !base_valid || nl.dirty || nl.pins.size() != base_pins)
+        return true;
+    if (movable_idx.size() != cells.size())
+        return true;
+    size_t k = 0;
+    for (size_t i = 0; i < cells.size(); ++i) {
+        if (cells[i]->is_fixed() != (movable_idx[i] < 0))
+            return true;
+        if (cells[i]->is_fixed() && (k >= base_fixed.size() || cells[i]->get_coords() != base_fixed[k++]))
+            return true;
     }
+    return false;
 }
 
-void circuit::build_solver_matrix(fabric* fab) {
-    int ncells = cells.size();
-    Q = new solver_matrix();
-    Q->n = 0;
+void circuit::invalidate_solver_matrix() {
+    base_valid = false;
+}
 
-    // stored in compressed sparse column format
-    
-    // cerr << "ncells " << ncells << endl;
-    // cerr << "maxn " << 1+(ncells*ncells)/2 << endl;
-    int last_pushed_x = -1;
-    for(int x = 0; x < ncells; ++x) {
-        cell* xcell = cells[x];
-        if (xcell->is_fixed())
-            continue;
+// O(n): each movable cell's diagonal and RHS entry is reset to the
+// connectivity value plus its current spreading anchor, if any
+void circuit::apply_spread_anchors(fabric* fab) {
+    for (int i = 0; i < (int)movable_cells.size(); ++i) {
+        cell* c = cells[movable_cells[i]];
+        double d = base_diag[i];
+        double cx = base_Cx[i];
+        double cy = base_Cy[i];
+
+        bin* b = (fab != nullptr) ? fab->get_cell_bin(c) : nullptr;
+        if (b != nullptr) {
+            spdlog::debug("found bin for cell {} @ {}, {}", c->label, b->x, b->y);
+            d += fab->spread_weight;
+            cx += (double)(fab->spread_weight * b->x);
+            cy += (double)(fab->spread_weight * b->y);
+        }
 
-        int movable_y_count = 0;
-        for(int y = 0; y < ncells; ++y) {
-            cell* ycell = cells[y];
-            double val = 0.;
-            
-            if (ycell->is_fixed())
-                continue;
+        Q->Ax[diag_pos[i]] = d;
+        Q->Cx[i] = cx;
+        Q->Cy[i] = cy;
+    }
+    // star rows have no anchor
+    for (int i = movable_cells.size(); i < Q->n; ++i) {
+        Q->Ax[diag_pos[i]] = base_diag[i];
+        Q->Cx[i] = base_Cx[i];
+        Q->Cy[i] = base_Cy[i];
+    }
+}
+
+// movable cells are numbered in file order, these are the matrix rows/cols
+void circuit::number_movable_cells() {
+    int ncells = cells.size();
+    movable_idx.assign(ncells, -1);
+    movable_cells.clear();
+    for(int i = 0; i < ncells; ++i) {
+        if (!cells[i]->is_fixed()) {
+            movable_idx[i] = movable_cells.size();
+            movable_cells.push_back(i);
+        }
+    }
+}
+
+bool circuit::is_star_net(int n) {
+    return n < (int)net_star.size() && net_star[n] >= 0;
+}
 
-            ++movable_y_count;
+void circuit::build_solver_matrix() {
+    netlist* nl = get_netlist();
+    if (Q)
+        delete(Q);
+    Q = new solver_matrix();
+    number_movable_cells();
+    Q->n = movable_cells.size();
+
+    // star nets get one more variable each, after the cells
+    net_star.assign(nl->n_nets(), -1);
+    star_nets.clear();
+    for(int n = 0; n < nl->n_nets(); ++n) {
+        int p = nl->n_pins(n);
+        bool star = (model == STAR && p >= 3) || (model == CLIQUE && star_fanout > 0 && p > star_fanout);
+        if (star) {
+            net_star[n] = Q->n++;
+            star_nets.push_back(n);
+        }
+    }
 
-            if (x==y)
-                val = sum_all_connected_weights(xcell, fab);
-            else if (xcell->is_connected_to(ycell))
-                val = -1*get_clique_weight(xcell,ycell);
+    // accumulate the clique contributions as (row, col, val) triplets,
+    // one pass over the nets instead of comparing every pair of cells
+    vector<int> Ti, Tj;
+    vector<double> Tx;
+    vector<double> diag(Q->n, 0.);
+    vector<int> pins;
+    for(int n = 0; n < nl->n_nets(); ++n) {
+        double w = nets[n]->get_weight();
+        int n_fixed = 0;
+        pins.clear();
+        for(const int* c = nl->net_cells_begin(n); c != nl->net_cells_end(n); ++c) {
+            if (movable_idx[*c] < 0)
+                ++n_fixed;
             else
-                continue;   //no connection, this becomes a zero
+                pins.push_back(movable_idx[*c]);
+        }
 
-            // put clique weight in this cell location
-            if (last_pushed_x != Q->n) {
-                last_pushed_x = Q->n;
-                Q->Ap.push_back(Q->Ax.size());
+        int p = pins.size() + n_fixed;
+        if (net_star[n] >= 0) {
+            // p edges of weight p*w to the star instead of p(p-1)/2 of weight w,
+            // the same system once the star is eliminated. the fixed weight
+            // bias stays on direct edges from each movable pin to each fixed
+            // pin, as in the clique model
+            int s = net_star[n];
+            double g = p*w;
+            diag[s] += p*g;
+            for(int a : pins) {
+                diag[a] += g + n_fixed*fixed_weight_bias;
+                Ti.push_back(a);
+                Tj.push_back(s);
+                Tx.push_back(-g);
+                Ti.push_back(s);
+                Tj.push_back(a);
+                Tx.push_back(-g);
             }
-            Q->Ax.push_back(val);
-            Q->Ai.push_back(movable_y_count-1);
+            continue;
+        }
+        for(int a : pins) {
+            diag[a] += (p - 1)*w + n_fixed*fixed_weight_bias;
+            for(int b : pins) {
+                if (a != b) {
+                    Ti.push_back(a);
+                    Tj.push_back(b);
+                    Tx.push_back(-w);
+                }
+            }
+        }
+    }
 
+    // diagonal is always stored, even if the cell is unconnected
+    for(int i = 0; i < Q->n; ++i) {
+        Ti.push_back(i);
+        Tj.push_back(i);
+        Tx.push_back(diag[i]);
+    }
+
+    // stored in compressed sparse column format
+    Q->from_triplets(Ti, Tj, Tx);
+
+    base_diag = diag;
+    diag_pos.assign(Q->n, -1);
+    for(int j = 0; j < Q->n; ++j) {
+        for(int k = Q->Ap[j]; k < Q->Ap[j+1]; ++k) {
+            if (Q->Ai[k] == j)
+                diag_pos[j] = k;
         }
-        ++Q->n;
     }
-    Q->Ap.push_back(Q->Ax.size());
+    base_pins = nl->pins.size();
+    base_valid = true;
 #if 0 
     cerr << "checking by inspection...." << endl;
     cerr << "n: " << Q->n << endl;
@@ -249,43 +797,81 @@ solver_matrix* circuit::get_solver_matrix() {
     return Q;
 }
 
-void circuit::umfpack(enum axis ax, double* res) {
-    #ifndef GTEST
-    int rc;
-    double *null = (double *) NULL ;
-    void *Symbolic, *Numeric ;
-
-    rc = umfpack_di_symbolic (Q->n, Q->n, Q->get_Ap_ss(), Q->get_Ai_ss(), Q->get_Ax_ss(), &Symbolic, null, null) ;
-    if (rc != UMFPACK_OK) {
-        spdlog::error("Error in umfpack_di_symbolic: {}", rc);
-    }
-
-    rc = umfpack_di_numeric (Q->get_Ap_ss(), Q->get_Ai_ss(), Q->get_Ax_ss(), Symbolic, &Numeric, null, null) ;
-    if (rc != UMFPACK_OK) {
-        spdlog::error("Error in umfpack_di_numeric: {}", rc);
-    }
-
-    umfpack_di_free_symbolic (&Symbolic) ;
-
-    rc = umfpack_di_solve (UMFPACK_A, Q->get_Ap_ss(), Q->get_Ai_ss(), Q->get_Ax_ss(), res, Q->get_C_ss(ax), Numeric, null, null) ;
-    if (rc != UMFPACK_OK) {
-        spdlog::error("Error in umfpack_di_solve: {}", rc);
-    }
+void circuit::set_solver(solver* s) {
+    if (slv)
+        delete(slv);
+    slv = s;
+}
 
-    umfpack_di_free_numeric (&Numeric) ;
-    #endif
+solver* circuit::get_solver() {
+    return slv;
 }
 
 void circuit::iter(fabric* fab) {
-    build_solver_matrix(fab);
-    build_solver_rhs(fab);
+    // B2B needs a placement to pick each net's bounds from, the first
+    // solve is a clique solve
+    if (model == B2B && placed) {
+        iter_b2b(fab);
+        return;
+    }
+
+    auto t0 = chrono::steady_clock::now();
+    bool rebuilt = solver_matrix_stale();
+    if (rebuilt)
+        build_solver_matrix();
+    auto t1 = chrono::steady_clock::now();
+    if (rebuilt)
+        build_solver_rhs();
+    apply_spread_anchors(fab);
+    auto t2 = chrono::steady_clock::now();
 
     double* x = new double[Q->n];
     double* y = new double[Q->n];
     int i=0;
 
-    umfpack(X, x);
-    umfpack(Y, y);
+    // the previous placement is the starting point for iterative solvers
+    for (auto& cell : cells) {
+        if (!cell->is_fixed()) {
+            pair<double,double> coords = cell->get_coords();
+            x[i] = get<0>(coords);
+            y[i] = get<1>(coords);
+            ++i;
+        }
+    }
+    // stars start at the mean of their pins until they have been solved for
+    if (star_x.size() != star_nets.size()) {
+        star_x.assign(star_nets.size(), 0.);
+        star_y.assign(star_nets.size(), 0.);
+        for (size_t k = 0; k < star_nets.size(); ++k) {
+            int n = star_nets[k];
+            for (const int* c = nl.net_cells_begin(n); c != nl.net_cells_end(n); ++c) {
+                pair<double,double> coords = cells[*c]->get_coords();
+                star_x[k] += get<0>(coords);
+                star_y[k] += get<1>(coords);
+            }
+            star_x[k] /= nl.n_pins(n);
+            star_y[k] /= nl.n_pins(n);
+        }
+    }
+    for (size_t k = 0; k < star_nets.size(); ++k, ++i) {
+        x[i] = star_x[k];
+        y[i] = star_y[k];
+    }
+    i=0;
+
+    slv->factor(Q);
+    auto t3 = chrono::steady_clock::now();
+
+    // the axes share Q and its factorization, only the RHS differs
+    if (parallel_axes) {
+        thread tx(&solver::solve, slv, Q, X, x);
+        slv->solve(Q, Y, y);
+        tx.join();
+    } else {
+        slv->solve(Q, X, x);
+        slv->solve(Q, Y, y);
+    }
+    auto t4 = chrono::steady_clock::now();
 
     for (auto& cell : cells) { 
         if (!cell->is_fixed()) {
@@ -295,38 +881,199 @@ void circuit::iter(fabric* fab) {
         }
     }
 
-    assert(i == Q->n);
+    assert(i == (int)movable_cells.size());
+    for (size_t k = 0; k < star_nets.size(); ++k, ++i) {
+        star_x[k] = x[i];
+        star_y[k] = y[i];
+    }
+    placed = true;
     spdlog::info("HPWL: {}", hpwl());
+    spdlog::info("iter timing ({}, {}): matrix {:.3f} ms, rhs {:.3f} ms, factor {:.3f} ms, solve {:.3f} ms",
+        parallel_axes ? "parallel axes" : "serial axes",
+        rebuilt ? "rebuilt" : "anchors only",
+        chrono::duration<double,milli>(t1-t0).count(),
+        chrono::duration<double,milli>(t2-t1).count(),
+        chrono::duration<double,milli>(t3-t2).count(),
+        chrono::duration<double,milli>(t4-t3).count());
 
     delete[] x;
     delete[] y;
 }
 
+void circuit::set_parallel_axes(bool p) {
+    parallel_axes = p;
+}
+
+// CLIQUE with a star fanout turns nets with more pins than that into stars,
+// which keeps Q from filling in on high fanout nets. STAR does it for every
+// net of three or more pins. B2B ignores the fanout
+void circuit::set_net_model(net_model m, int _star_fanout) {
+    model = m;
+    star_fanout = _star_fanout;
+    star_x.clear();
+    star_y.clear();
+    net_star.clear();
+    star_nets.clear();
+    invalidate_solver_matrix();
+}
+
+// one axis of the bound2bound model at the current placement: every pin
+// connects to the lowest and highest pin of its net with weight
+// 2/((p-1)*distance), so the quadratic cost is twice the net's HPWL there
+void circuit::build_b2b_system(enum axis ax, solver_matrix* M, fabric* fab) {
+    int nm = movable_cells.size();
+    vector<int> Ti, Tj;
+    vector<double> Tx;
+    vector<double> diag(nm, 0.);
+    vector<double> C(nm, 0.);
+
+    auto coord = [&](int c) {
+        pair<double,double> coords = cells[c]->get_coords();
+        return (ax == X) ? get<0>(coords) : get<1>(coords);
+    };
+    auto connect = [&](int c1, int c2, double w) {
+        int a = movable_idx[c1];
+        int b = movable_idx[c2];
+        if (a < 0 && b < 0)
+            return;
+        if (a < 0 || b < 0)
+            w += fixed_weight_bias;
+        if (a >= 0) {
+            diag[a] += w;
+            if (b >= 0) {
+                Ti.push_back(a);
+                Tj.push_back(b);
+                Tx.push_back(-w);
+            } else {
+                C[a] += w*coord(c2);
+            }
+        }
+        if (b >= 0) {
+            diag[b] += w;
+            if (a >= 0) {
+                Ti.push_back(b);
+                Tj.push_back(a);
+                Tx.push_back(-w);
+            } else {
+                C[b] += w*coord(c1);
+            }
+        }
+    };
+
+    for (int n = 0; n < nl.n_nets(); ++n) {
+        int p = nl.n_pins(n);
+        if (p < 2)
+            continue;
+        const int* pins = nl.net_cells_begin(n);
+        int lo = 0, hi = 1;
+        if (coord(pins[hi]) < coord(pins[lo]))
+            swap(lo, hi);
+        for (int k = 2; k < p; ++k) {
+            if (coord(pins[k]) < coord(pins[lo]))
+                lo = k;
+            else if (coord(pins[k]) > coord(pins[hi]))
+                hi = k;
+        }
+        for (int k = 0; k < p; ++k) {
+            double z = coord(pins[k]);
+            if (k != lo)
+                connect(pins[k], pins[lo], 2./((p-1)*max(fabs(z - coord(pins[lo])), B2B_MIN_DIST)));
+            if (k != lo && k != hi)
+                connect(pins[k], pins[hi], 2./((p-1)*max(fabs(coord(pins[hi]) - z), B2B_MIN_DIST)));
+        }
+    }
+
+    for (int i = 0; i < nm; ++i) {
+        bin* b = (fab != nullptr) ? fab->get_cell_bin(cells[movable_cells[i]]) : nullptr;
+        if (b != nullptr) {
+            diag[i] += fab->spread_weight;
+            C[i] += fab->spread_weight * ((ax == X) ? b->x : b->y);
+        }
+        Ti.push_back(i);
+        Tj.push_back(i);
+        Tx.push_back(diag[i]);
+    }
+
+    M->n = nm;
+    M->from_triplets(Ti, Tj, Tx);
+    M->Cx = C;
+    M->Cy = C;
+}
+
+// the axes have different matrices under B2B. the systems are built
+// concurrently, then factored and solved one after the other since the
+// solver keeps a single factorization
+void circuit::iter_b2b(fabric* fab) {
+    auto t0 = chrono::steady_clock::now();
+    get_netlist();
+    number_movable_cells();
+    for (auto*& M : Qb2b) {
+        if (M == nullptr)
+            M = new solver_matrix();
+    }
+    if (parallel_axes) {
+        thread tx(&circuit::build_b2b_system, this, X, Qb2b[0], fab);
+        build_b2b_system(Y, Qb2b[1], fab);
+        tx.join();
+    } else {
+        build_b2b_system(X, Qb2b[0], fab);
+        build_b2b_system(Y, Qb2b[1], fab);
+    }
+    auto t1 = chrono::steady_clock::now();
+
+    int nm = movable_cells.size();
+    vector<double> x(nm), y(nm);
+    for (int i = 0; i < nm; ++i) {
+        pair<double,double> coords = cells[movable_cells[i]]->get_coords();
+        x[i] = get<0>(coords);
+        y[i] = get<1>(coords);
+    }
+
+    slv->factor(Qb2b[0]);
+    slv->solve(Qb2b[0], X, x.data());
+    slv->factor(Qb2b[1]);
+    slv->solve(Qb2b[1], Y, y.data());
+    auto t2 = chrono::steady_clock::now();
+
+    for (int i = 0; i < nm; ++i)
+        cells[movable_cells[i]]->set_coords(x[i], y[i]);
+
+    spdlog::info("HPWL: {}", hpwl());
+    spdlog::info("iter timing (b2b): matrix {:.3f} ms, factor+solve {:.3f} ms",
+        chrono::duration<double,milli>(t1-t0).count(),
+        chrono::duration<double,milli>(t2-t1).count());
+}
+
 double circuit::get_clique_weight(cell* c1, cell* c2) {
     // need to get the common net
-    vector<string> net_labels = c1->get_mutual_net_labels(c2);
     double result = 0.;
-    for (auto& s : net_labels) {
-        net* n = get_net(s);
-        result += n->get_weight();
+    for (int n : get_netlist()->mutual_nets(c1->id, c2->id)) {
+        if (is_star_net(n))
+            continue;   // the cells only meet through the star
+        result += nets[n]->get_weight();
     }
     return result;
 }
 
+// the cell's clique diagonal. star nets' edges go to their star variable
+// instead, see build_solver_matrix
 double circuit::sum_all_connected_weights(cell* c, fabric* fab) {
     double result = 0.0;
     
+    netlist* nl = get_netlist();
     spdlog::debug("cell {}:", c->label);
-    for (auto& s : c->get_net_labels()) {
-        net* n = get_net(s);
+    for (const int* s = nl->cell_nets_begin(c->id); s != nl->cell_nets_end(c->id); ++s) {
+        if (is_star_net(*s))
+            continue;
+        net* n = nets[*s];
 
-        for (auto& cell_label : n->get_cell_labels()) {
-            cell* other = get_cell(cell_label);
+        for (const int* o = nl->net_cells_begin(*s); o != nl->net_cells_end(*s); ++o) {
+            cell* other = cells[*o];
             if (other != c) {
                 double addition = n->get_weight();
                 if (other->is_fixed()) {
                     addition += fixed_weight_bias;
-                    spdlog::debug("adding fixed weight bias to cell {} other {} by net {}", c->label, other->label, s);
+                    spdlog::debug("adding fixed weight bias to cell {} other {} by net {}", c->label, other->label, n->label);
                 }
                 spdlog::debug("\tadding net {}, weight {} (from cell {})", n->label, addition, other->label);
                 result += addition;
@@ -334,14 +1081,10 @@ double circuit::sum_all_connected_weights(cell* c, fabric* fab) {
         }
     }
 
-    if (fab != nullptr) {
-        for (bin* b : fab->get_used_bins()) {
-            if (find(b->cells.begin(), b->cells.end(), c) != b->cells.end()) {
-                spdlog::debug("adj: found bin for cell @ bin {}, {}", b->x, b->y);
-                result += fab->spread_weight;
-                break;
-            }
-        }
+    bin* b = (fab != nullptr) ? fab->get_cell_bin(c) : nullptr;
+    if (b != nullptr) {
+        spdlog::debug("adj: found bin for cell @ bin {}, {}", b->x, b->y);
+        result += fab->spread_weight;
     }
 
     spdlog::debug("\ttotal: {}", result);
@@ -350,8 +1093,15 @@ double circuit::sum_all_connected_weights(cell* c, fabric* fab) {
 }
 
 circuit::~circuit() {
+    delete(slv);
     if (Q)
         delete(Q);
+    for (auto* M : Qb2b)
+        delete(M);
+    for (auto* c : cells)
+        delete(c);
+    for (auto* n : nets)
+        delete(n);
 }
 
 bool circuit::connects_to_fixed_cell(cell* c1) {
@@ -359,13 +1109,23 @@ bool circuit::connects_to_fixed_cell(cell* c1) {
 }
 
 vector<cell*> circuit::get_connected_fixed_cells(cell* c1) {
-    vector<cell*> result;
-    for(auto& nl : fixed_cell_labels) {
-        cell* other = get_cell(nl);
-        if ( c1->is_connected_to(other) ) {
-            result.push_back(other);
+    netlist* nl = get_netlist();
+    vector<int> ids;
+    for (const int* n = nl->cell_nets_begin(c1->id); n != nl->cell_nets_end(c1->id); ++n) {
+        if (is_star_net(*n))
+            continue;
+        for (const int* o = nl->net_cells_begin(*n); o != nl->net_cells_end(*n); ++o) {
+            if (*o != c1->id && cells[*o]->is_fixed())
+                ids.push_back(*o);
         }
     }
+    sort(ids.begin(), ids.end());
+    ids.erase(unique(ids.begin(), ids.end()), ids.end());
+
+    vector<cell*> result;
+    for (int id : ids) {
+        result.push_back(cells[id]);
+    }
     return result;
 }
 
@@ -376,49 +1136,103 @@ void circuit::foreach_cell(void (*fn)(circuit* circ, cell* c)) {
 }
 
 void circuit::foreach_net(void (*fn)(circuit* circ, net* c)) {
-    for(auto& c : nets) {
-        fn(this, c.second);
+    get_netlist();
+    for(auto* n : nets) {
+        fn(this, n);
     }
 }
 
+// sum of the nets' half perimeters, fixed pins included. O(1) while the
+// cached boxes are current, O(pins) to rebuild them after cells were moved
+// other than through move_cell
 double circuit::hpwl() {
-    double min_x=0.;
-    double max_x=0.;
-    double min_y=0.;
-    double max_y=0.;
-    
-    bool first = true;
-
-    for(auto* c: cells) {
-        if (!c->is_fixed()) {
-            pair<double,double> coords = c->get_coords();
-            double x = get<0>(coords);
-            double y = get<1>(coords);
-            if (first) {
-                min_y = y;
-                min_x = x;
-                max_y = y;
-                max_x = x;
-                first = false;
-            }
+    sync_net_boxes();
+    return total_hpwl;
+}
+
+double circuit::net_hpwl(int n) {
+    sync_net_boxes();
+    return boxes[n].hpwl();
+}
+
+void circuit::compute_net_box(int n) {
+    net_box& b = boxes[n];
+    int p = nl.n_pins(n);
+    if (p == 0) {
+        b.x0 = b.x1 = b.y0 = b.y1 = 0.;     // no pins, no length
+        b.n_x0 = b.n_x1 = b.n_y0 = b.n_y1 = 0;
+        return;
+    }
+    gather_box(nl.xs.data(), nl.net_cells_begin(n), p, &b.x0, &b.x1, &b.n_x0, &b.n_x1);
+    gather_box(nl.ys.data(), nl.net_cells_begin(n), p, &b.y0, &b.y1, &b.n_y0, &b.n_y1);
+}
 
-            if (y < min_y)
-                min_y = y; 
-            if (y > max_y)
-                max_y = y;
+void circuit::sync_net_boxes() {
+    get_netlist();
+    if (box_moves == nl.moves && box_pins == nl.pins.size() && (int)boxes.size() == nl.n_nets())
+        return;
+    boxes.resize(nl.n_nets());
+    total_hpwl = 0.;
+    for (int n = 0; n < nl.n_nets(); ++n) {
+        compute_net_box(n);
+        total_hpwl += boxes[n].hpwl();
+    }
+    box_moves = nl.moves;
+    box_pins = nl.pins.size();
+}
 
-            if (x > max_x)
-                max_x = x;
-            if (x < min_x)
-                min_x = x; 
+// one axis of a pin moving from a to b. false if an edge lost its last pin
+// and the box has to be rescanned
+static bool move_pin(double& lo, int& n_lo, double& hi, int& n_hi, double a, double b) {
+    if (a == lo)
+        --n_lo;
+    if (a == hi)
+        --n_hi;
+    if (b < lo) {
+        lo = b;
+        n_lo = 1;
+    } else if (b == lo) {
+        ++n_lo;
+    }
+    if (b > hi) {
+        hi = b;
+        n_hi = 1;
+    } else if (b == hi) {
+        ++n_hi;
+    }
+    return n_lo > 0 && n_hi > 0;
+}
+
+// moves c and updates the boxes of its nets only, returns the change in hpwl
+double circuit::move_cell(cell* c, double x, double y) {
+    sync_net_boxes();
+    pair<double,double> coords = c->get_coords();
+    double x0 = get<0>(coords);
+    double y0 = get<1>(coords);
+    double before = total_hpwl;
+
+    for (const int* n = nl.cell_nets_begin(c->id); n != nl.cell_nets_end(c->id); ++n) {
+        net_box& b = boxes[*n];
+        double old = b.hpwl();
+        bool ok = move_pin(b.x0, b.n_x0, b.x1, b.n_x1, x0, x);
+        ok = move_pin(b.y0, b.n_y0, b.y1, b.n_y1, y0, y) && ok;
+        if (!ok) {
+            // rescanned with c already in place
+            c->set_coords(x, y, c->is_fixed());
+            compute_net_box(*n);
+            c->set_coords(x0, y0, c->is_fixed());
         }
+        total_hpwl += b.hpwl() - old;
     }
-    return (max_x - min_x) + (max_y - min_y);
+    c->set_coords(x, y, c->is_fixed());
+    box_moves = nl.moves;
+    return total_hpwl - before;
 }
 
 void circuit::set_fixed_weight_bias(double n) {
     spdlog::debug("WE CHANGE TO {}", n);
     fixed_weight_bias = n;
+    invalidate_solver_matrix();
 }
 
 /****
@@ -434,28 +1248,69 @@ bool cell::is_fixed() {
 cell::cell(vector<string> s) {
     x = 0;
     y = 0;
+    area = 1.;
     label = s[0];
+    id = -1;
+    nl = nullptr;
     fixed = false;
     //nets = std::vector<string>(s.begin()+1,s.end()-1);
 }
 
+cell::cell(netlist* _nl, int _id) {
+    x = 0;
+    y = 0;
+    area = 1.;
+    nl = _nl;
+    id = _id;
+    if ((int)nl->xs.size() <= id) {
+        nl->xs.resize(id+1, 0.);
+        nl->ys.resize(id+1, 0.);
+    }
+    label = nl->cell_labels[id];
+    fixed = false;
+}
+
+void cell::set_area(double a) {
+    area = a;
+}
+
+double cell::get_area() {
+    return area;
+}
+
 void cell::set_coords(double _x, double _y, bool _fixed) {
-    x = _x;
-    y = _y;
     fixed = _fixed;
+    if (nl != nullptr) {
+        nl->xs[id] = _x;
+        nl->ys[id] = _y;
+        ++nl->moves;
+    } else {
+        x = _x;
+        y = _y;
+    }
 }
 
 unordered_set<string> cell::get_net_labels() {
-    return net_labels;
+    unordered_set<string> result;
+    if (nl == nullptr)
+        return result;
+    nl->build();
+    for (const int* n = nl->cell_nets_begin(id); n != nl->cell_nets_end(id); ++n) {
+        result.insert(nl->net_labels[*n]);
+    }
+    return result;
 }
 
 pair<double,double> cell::get_coords() {
+    if (nl != nullptr)
+        return pair<double,double>(nl->xs[id], nl->ys[id]);
     return pair<double,double>(x,y);
 }
 
 void cell::add_net(string s) {
     assert(s.length() > 0);
-    net_labels.insert(s); 
+    assert(nl != nullptr);
+    nl->add_pin(id, nl->add_net(s));
 }
 
 void cell::add_net(net& n) {
@@ -463,30 +1318,19 @@ void cell::add_net(net& n) {
 }
 
 bool cell::is_connected_to(cell* other) {
-    return (get_mutual_net_labels(other).size() > 0);
+    if (nl == nullptr || other->nl != nl)
+        return false;
+    return (nl->mutual_nets(id, other->id).size() > 0);
 }
 
 vector<string> cell::get_mutual_net_labels(cell* other) {
-    vector<string> my_net_labels_ordered;
-    vector<string> other_net_labels_ordered;
-    
-    
-    for (auto n : net_labels) {
-        my_net_labels_ordered.push_back(n);
-    }
-    
-    for (auto n : other->net_labels) {
-        other_net_labels_ordered.push_back(n);
-    }
-
-    sort(my_net_labels_ordered.begin(), my_net_labels_ordered.end());
-    sort(other_net_labels_ordered.begin(), other_net_labels_ordered.end());
-
     vector<string> intersection;
+    if (nl == nullptr || other->nl != nl)
+        return intersection;
 
-    set_intersection(my_net_labels_ordered.begin(), my_net_labels_ordered.end(),
-                     other_net_labels_ordered.begin(), other_net_labels_ordered.end(),
-                     back_inserter(intersection));
+    for (int n : nl->mutual_nets(id, other->id)) {
+        intersection.push_back(nl->net_labels[n]);
+    }
     return intersection;
 }
 
@@ -508,7 +1352,8 @@ double cell::distance_to(cell* other) {
 
 void net::add_cell(string s) {
     assert(s.length() > 0);
-    cell_labels.insert(s);
+    assert(nl != nullptr);
+    nl->add_pin(nl->cell_ids.at(s), id);
 }
 
 void net::add_cell(cell& c) {
@@ -517,20 +1362,136 @@ void net::add_cell(cell& c) {
 
 net::net(string l) {
     label = l;
+    id = -1;
+    nl = nullptr;
+}
+
+net::net(netlist* _nl, int _id) {
+    nl = _nl;
+    id = _id;
+    label = nl->net_labels[id];
 }
 
 unordered_set<string> net::get_cell_labels() {
-    return cell_labels;
+    unordered_set<string> result;
+    if (nl == nullptr)
+        return result;
+    nl->build();
+    for (const int* c = nl->net_cells_begin(id); c != nl->net_cells_end(id); ++c) {
+        result.insert(nl->cell_labels[*c]);
+    }
+    return result;
 }
 
 int net::num_pins() {
-    return cell_labels.size();
+    if (nl == nullptr)
+        return 0;
+    nl->build();
+    return nl->n_pins(id);
 }
 
 double net::get_weight() {
     return (double)(2./(double)(num_pins()));
 }
 
+/****
+*
+* netlist struct functions
+*
+****/
+
+int netlist::add_cell(string label) {
+    auto it = cell_ids.find(label);
+    if (it != cell_ids.end())
+        return it->second;
+    int id = cell_labels.size();
+    cell_ids[label] = id;
+    cell_labels.push_back(label);
+    dirty = true;
+    return id;
+}
+
+int netlist::add_net(string label) {
+    auto it = net_ids.find(label);
+    if (it != net_ids.end())
+        return it->second;
+    int id = net_labels.size();
+    net_ids[label] = id;
+    net_labels.push_back(label);
+    dirty = true;
+    return id;
+}
+
+void netlist::add_pin(int cell_id, int net_id) {
+    pins.push_back(make_pair(cell_id, net_id));
+    dirty = true;
+}
+
+// counting sort of the pin list into both CSR directions; rows come out
+// sorted by id, repeated pins are dropped
+void netlist::build() {
+    if (!dirty)
+        return;
+
+    int ncells = n_cells();
+    int nnets = n_nets();
+
+    vector<int> cnt_ptr(ncells+1, 0);
+    vector<int> nnt_ptr(nnets+1, 0);
+    for (auto& p : pins) {
+        ++nnt_ptr[p.second+1];
+    }
+    for (int n = 0; n < nnets; ++n) {
+        nnt_ptr[n+1] += nnt_ptr[n];
+    }
+
+    // net -> cells, cells visited in pin order then sorted per net
+    vector<int> by_net(pins.size());
+    vector<int> next(nnt_ptr.begin(), nnt_ptr.end()-1);
+    for (auto& p : pins) {
+        by_net[next[p.second]++] = p.first;
+    }
+
+    net_ptr.assign(1, 0);
+    net_cells.clear();
+    net_cells.reserve(pins.size());
+    for (int n = 0; n < nnets; ++n) {
+        auto b = by_net.begin() + nnt_ptr[n];
+        auto e = by_net.begin() + nnt_ptr[n+1];
+        sort(b, e);
+        e = unique(b, e);
+        net_cells.insert(net_cells.end(), b, e);
+        net_ptr.push_back(net_cells.size());
+    }
+
+    // cell -> nets is the transpose, rows sorted because nets are visited in order
+    for (int c : net_cells) {
+        ++cnt_ptr[c+1];
+    }
+    for (int c = 0; c < ncells; ++c) {
+        cnt_ptr[c+1] += cnt_ptr[c];
+    }
+    cell_ptr = cnt_ptr;
+    cell_nets.resize(net_cells.size());
+    next.assign(cnt_ptr.begin(), cnt_ptr.end()-1);
+    for (int n = 0; n < nnets; ++n) {
+        for (int k = net_ptr[n]; k < net_ptr[n+1]; ++k) {
+            cell_nets[next[net_cells[k]]++] = n;
+        }
+    }
+
+    dirty = false;
+}
+
+vector<int> netlist::mutual_nets(int cell_a, int cell_b) {
+    build();
+    vector<int> result;
+    set_intersection(cell_nets_begin(cell_a), cell_nets_end(cell_a),
+                     cell_nets_begin(cell_b), cell_nets_end(cell_b),
+                     back_inserter(result));
+    return result;
+}
+
 /****
 *
 * solver_matrix struct functions
@@ -549,6 +1510,66 @@ double* solver_matrix::get_Ax_ss() {
     return &Ax[0];
 }
 
+// builds Ap/Ai/Ax from unordered (row, col, val) triplets, summing duplicates.
+// bucketing by row and then by column leaves each column sorted by row
+// without a comparison sort, so this is linear in the number of triplets
+void solver_matrix::from_triplets(const vector<int>& Ti, const vector<int>& Tj, const vector<double>& Tx) {
+    int nz = Tx.size();
+
+    // pass 1: bucket by row
+    vector<int> Rp(n+1, 0);
+    for(int k = 0; k < nz; ++k)
+        ++Rp[Ti[k]+1];
+    for(int i = 0; i < n; ++i)
+        Rp[i+1] += Rp[i];
+
+    vector<int> Rj(nz);
+    vector<double> Rx(nz);
+    vector<int> next(Rp.begin(), Rp.end()-1);
+    for(int k = 0; k < nz; ++k) {
+        int dst = next[Ti[k]]++;
+        Rj[dst] = Tj[k];
+        Rx[dst] = Tx[k];
+    }
+
+    // pass 2: bucket by column, visiting rows in order
+    vector<int> Cp(n+1, 0);
+    for(int k = 0; k < nz; ++k)
+        ++Cp[Rj[k]+1];
+    for(int j = 0; j < n; ++j)
+        Cp[j+1] += Cp[j];
+
+    vector<int> Ci(nz);
+    vector<double> Cv(nz);
+    next.assign(Cp.begin(), Cp.end()-1);
+    for(int i = 0; i < n; ++i) {
+        for(int k = Rp[i]; k < Rp[i+1]; ++k) {
+            int dst = next[Rj[k]]++;
+            Ci[dst] = i;
+            Cv[dst] = Rx[k];
+        }
+    }
+
+    // pass 3: merge duplicate (row, col) entries
+    Ap.assign(1, 0);
+    Ai.clear();
+    Ax.clear();
+    Ai.reserve(nz);
+    Ax.reserve(nz);
+    for(int j = 0; j < n; ++j) {
+        int col_start = Ai.size();
+        for(int k = Cp[j]; k < Cp[j+1]; ++k) {
+            if ((int)Ai.size() > col_start && Ai.back() == Ci[k])
+                Ax.back() += Cv[k];
+            else {
+                Ai.push_back(Ci[k]);
+                Ax.push_back(Cv[k]);
+            }
+        }
+        Ap.push_back(Ai.size());
+    }
+}
+
 double* solver_matrix::get_C_ss(enum axis ax) {
     if (ax == X) 
         return &Cx[0];
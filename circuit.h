@@ -19,16 +19,85 @@ enum axis {
     Y
 };
 
+// how the pins of a net are tied together in the placement system
+enum net_model {
+    CLIQUE,     // every pair of pins, weight 2/p (net::get_weight)
+    STAR,       // every pin to one extra variable per net, weight 2
+    B2B         // bound2bound: every pin to the net's outermost pins on each
+                // axis, re-derived from the placement before every solve
+};
+
+// B2B weights are 2/((p-1)*distance); pins closer than this count as this far
+#define B2B_MIN_DIST 0.5
+
 class cell;
 class fabric;
+class solver;
+
+// binary netlist file written by circuit::write_binary, see circuit.cpp
+#define NETLIST_FILE_MAGIC "A2NL"
+#define NETLIST_FILE_VERSION 2
+
+struct netlist_file_header {
+    char magic[4];
+    uint32_t version;
+    uint32_t n_cells;
+    uint32_t n_nets;
+    uint32_t n_pins;
+    uint32_t label_bytes;
+    uint64_t checksum;
+};
+
+// dense integer ids for cells and nets, with the pins stored twice in flat
+// CSR arrays (net -> cells and cell -> nets), each row sorted by id.
+// labels only live in the side tables and are used for I/O
+struct netlist {
+    vector<string> cell_labels;
+    vector<string> net_labels;
+    unordered_map<string, int> cell_ids;
+    unordered_map<string, int> net_ids;
+
+    vector<int> net_ptr;    // size n_nets()+1, offsets into net_cells
+    vector<int> net_cells;
+    vector<int> cell_ptr;   // size n_cells()+1, offsets into cell_nets
+    vector<int> cell_nets;
+
+    // (cell, net) pairs as read, turned into the CSR arrays by build()
+    vector<pair<int,int>> pins;
+    bool dirty = false;
+    // bumped by cell::set_coords, so cached net bounding boxes can tell
+    // that cells moved behind their back
+    unsigned long moves = 0;
+    // cell coordinates by cell id, kept here rather than in the cells so
+    // the hpwl and displacement kernels can gather them directly
+    vector<double> xs;
+    vector<double> ys;
+
+    int add_cell(string label);
+    int add_net(string label);
+    void add_pin(int cell_id, int net_id);
+    void build();
+
+    int n_cells() { return cell_labels.size(); }
+    int n_nets() { return net_labels.size(); }
+    int n_pins(int net_id) { return net_ptr[net_id+1] - net_ptr[net_id]; }
+    int n_nets_of(int cell_id) { return cell_ptr[cell_id+1] - cell_ptr[cell_id]; }
+    const int* net_cells_begin(int net_id) { return net_cells.data() + net_ptr[net_id]; }
+    const int* net_cells_end(int net_id) { return net_cells_begin(net_id) + n_pins(net_id); }
+    const int* cell_nets_begin(int cell_id) { return cell_nets.data() + cell_ptr[cell_id]; }
+    const int* cell_nets_end(int cell_id) { return cell_nets_begin(cell_id) + n_nets_of(cell_id); }
+    vector<int> mutual_nets(int cell_a, int cell_b);
+};
 
 class net {
     private:
-        unordered_set<string> mutable cell_labels;
+        netlist* nl;
     public:
         string label;
+        int id;
 
         net(string l);
+        net(netlist* _nl, int _id);
         unordered_set<string> get_cell_labels();
         bool operator==(const net& other) const {
             return this->label == other.label;
@@ -41,17 +110,22 @@ class net {
 
 class cell {
     private:
-        double x;
+        double x;       // only used without a netlist, see netlist::xs
         double y;
+        double area;    // in bins, 1 unless the circuit file says otherwise
         bool fixed;
-        unordered_set<string> net_labels;
+        netlist* nl;
 
     public:
         string label;
+        int id;
         cell(vector<string> s);
+        cell(netlist* _nl, int _id);
         void connect(cell* other);
         void set_coords(double _x, double _y, bool _fixed=false);
         pair<double,double> get_coords();
+        void set_area(double a);
+        double get_area();
         unordered_set<string> get_net_labels();
         void add_net(net& n);
         void add_net(string s);
@@ -59,6 +133,15 @@ class cell {
         vector<string> get_mutual_net_labels(cell* other);
         bool is_fixed();
         double distance_to(cell* other);
+        netlist* get_netlist() { return nl; }
+};
+
+// bounding box of a net's pins, with how many pins sit on each edge so a
+// pin leaving an edge only forces a rescan of the net when it was the last
+struct net_box {
+    double x0, x1, y0, y1;
+    int n_x0, n_x1, n_y0, n_y1;
+    double hpwl() { return (x1 - x0) + (y1 - y0); }
 };
 
 struct solver_matrix {
@@ -76,19 +159,58 @@ struct solver_matrix {
     int* get_Ai_ss();
     double* get_Ax_ss();
     double* get_C_ss(enum axis);
-    
+    void from_triplets(const vector<int>& Ti, const vector<int>& Tj, const vector<double>& Tx);
+
 };
 
 class circuit {
     private:
         double fixed_weight_bias;
         solver_matrix* Q;
-        vector<cell*> cells;
-        unordered_set<string> fixed_cell_labels;
-        unordered_map<string, net*> nets;
-        void build_solver_matrix(fabric* fab = nullptr);
-        void build_solver_rhs(fabric* fab = nullptr);
-        void umfpack(enum axis ax, double* res);
+        netlist nl;
+        vector<cell*> cells;    // indexed by cell id
+        vector<net*> nets;      // indexed by net id
+        void read_netlist(string file);
+        bool read_netlist_binary(string file, const char* data, size_t size);
+        void build_solver_rhs();
+        void build_solver_rhs_axis(enum axis ax, double* C);
+        void number_movable_cells();
+
+        // net models, see set_net_model
+        net_model model;
+        int star_fanout;
+        vector<int> net_star;       // net id -> its star variable's row, -1 if not a star
+        vector<int> star_nets;      // star k (row movable_cells.size()+k) -> net id
+        vector<double> star_x;      // star positions from the last solve, for warm starts
+        vector<double> star_y;
+        bool is_star_net(int n);
+        bool placed;                // solved at least once, B2B needs a placement to start from
+        solver_matrix* Qb2b[2];     // per axis B2B systems
+        void build_b2b_system(enum axis ax, solver_matrix* M, fabric* fab);
+        void iter_b2b(fabric* fab);
+
+        // per net bounding boxes behind hpwl() and move_cell()
+        vector<net_box> boxes;
+        double total_hpwl;
+        unsigned long box_moves;    // netlist::moves the boxes are up to date with
+        size_t box_pins;
+        void compute_net_box(int n);
+        void sync_net_boxes();
+
+        // connectivity-only diagonal and RHS, see solver_matrix_stale()
+        vector<int> movable_idx;    // cell id -> matrix row, -1 if fixed
+        vector<int> movable_cells;  // matrix row -> cell id
+        vector<int> diag_pos;       // matrix row -> index of its diagonal in Ax
+        vector<double> base_diag;
+        vector<double> base_Cx;
+        vector<double> base_Cy;
+        vector<pair<double,double>> base_fixed;    // fixed cell coords the RHS was built from
+        size_t base_pins;
+        bool base_valid;
+        bool solver_matrix_stale();
+        void apply_spread_anchors(fabric* fab);
+        solver* slv;
+        bool parallel_axes;
 
     public:
         circuit(string s);
@@ -97,20 +219,33 @@ class circuit {
 
         bool fit(bool interactive);
         cell* get_cell(string label);
+        cell* get_cell(int id) { return cells[id]; }
         void add_cell_connections(vector<string> toks);
         void add_cell_fixed_coords(vector<string> toks);
         net* get_net(string label);
-        void add_net(string s);
+        net* get_net(int id) { return nets[id]; }
+        int add_net(string s);
+        netlist* get_netlist();
         double sum_all_connected_weights(cell* c, fabric* fab = nullptr);
         double get_clique_weight(cell* c1, cell* c2);
+        void build_solver_matrix();
         solver_matrix* get_solver_matrix();
+        void invalidate_solver_matrix();
         bool connects_to_fixed_cell(cell* c1);
         vector<cell*> get_connected_fixed_cells(cell* c1);
         void iter(fabric* fab = nullptr);
         void foreach_cell(void (*fn)(circuit* circ, cell* c));
         void foreach_net(void (*fn)(circuit* circ, net* n));
         double hpwl();
+        double net_hpwl(int n);
+        double move_cell(cell* c, double x, double y);
         void set_fixed_weight_bias(double n);
+        bool write_binary(string file);
+        void set_solver(solver* s);
+        solver* get_solver();
+        void set_parallel_axes(bool p);
+        void set_net_model(net_model m, int _star_fanout = 0);
+        net_model get_net_model() { return model; }
         vector<cell*> get_cells() {return cells;};
 };
 void circuit_wait_for_ui();
@@ -1,11 +1,18 @@
 #include "fabric.h"
 #include "circuit.h"
+#include "kernels.h"
 #include "spdlog/spdlog.h"
 #include <math.h>
 #include <vector>
 #include <queue>
 #include <stack>
-#include <map>
+#include <thread>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <fstream>
+#include <sstream>
+#include <limits>
 
 // forward declarations
 static double compute_cost(bin* bi, bin* bk);
@@ -13,33 +20,179 @@ double distance_cell_to_bin(cell* i, bin* j);
 
 using namespace std;
 
+// all bins live in one contiguous array, column by column, so a bin's id
+// is its index and a scan over the grid is a linear sweep
 fabric::fabric(int x, int y) {
-    bins = new bin**[x+1];
     width=x;
     height=y;
-    for(int i = 0; i <= x; i ++) {      // TODO this seems weird but input file necessitated?
-        bins[i] = new bin*[y+1];
+    overflow_sum = 0;
+    cell_moves = 0;
+    bins.resize((x+1)*(y+1));   // pads may sit on the far edge, x == width or y == height
+    search.resize(bins.size());
+    nearest_valid = false;
+    for(int i = 0; i <= x; i ++) {
         for(int j = 0; j <= y; j++) {
-            bins[i][j] = new bin;
-            bins[i][j]->x = (double)i;
-            bins[i][j]->y = (double)j;
-            bins[i][j]->usable = true;
-            bins[i][j]->capacity = 1; // assumption for this assignment
+            bin* b = get_bin(i,j);
+            b->id = bin_index(i,j);
+            b->x = (double)i;
+            b->y = (double)j;
+            b->usable = true;
+            b->capacity = 1.; // default, see set_capacity
+            b->used = 0.;
+            b->fixed_used = 0.;
         }
     }
 }
 
-fabric::~fabric() {
-    for(int i = 0; i <= width; i++) {
-        for(int j = 0; j <= height; j++) {
-            delete bins[i][j];
+/****
+ * fabric spec files
+ ****/
+
+// a region's corners are bin coordinates, lower left first, and it starts
+// on the fabric. regions past the far edge are clipped, see
+// mark_obstruction and set_capacity
+static bool valid_region(const vector<double>& v, fabric* fab) {
+    return v[0] >= 0 && v[1] >= 0 && v[0] <= v[2] && v[1] <= v[3]
+        && v[0] < fab->get_width() && v[1] < fab->get_height();
+}
+
+// one directive per line, # starts a comment. size must come first:
+//   size W H
+//   capacity C                  every bin, in cell area (may be fractional)
+//   capacity X0 Y0 X1 Y1 C      bins in the region, corners included
+//   obstruction X0 Y0 X1 Y1     region is unusable, corners included
+// returns nullptr if the file can't be read or has a bad line
+fabric* read_fabric_spec(string file) {
+    ifstream in(file);
+    if (!in) {
+        spdlog::error("Could not open fabric spec {}", file);
+        return nullptr;
+    }
+
+    fabric* fab = nullptr;
+    string line;
+    int lineno = 0;
+    while (getline(in, line)) {
+        ++lineno;
+        line = line.substr(0, line.find('#'));
+        istringstream ss(line);
+        string key;
+        if (!(ss >> key))
+            continue;
+
+        vector<double> v;
+        double n;
+        while (ss >> n)
+            v.push_back(n);
+        bool ok = ss.eof();
+        // everything but a capacity is a bin coordinate or count
+        for (size_t k = 0; k < v.size() && k < 4; ++k) {
+            if (v[k] != floor(v[k]) && !(key == "capacity" && k == v.size()-1))
+                ok = false;
         }
-        delete bins[i];
-    } 
+
+        if (key == "size" && fab == nullptr) {
+            ok = ok && v.size() == 2 && v[0] > 0 && v[1] > 0;
+            if (ok)
+                fab = new fabric(v[0], v[1]);
+        } else if (fab == nullptr) {
+            ok = false;
+        } else if (key == "capacity") {
+            if (ok && v.size() == 1 && v[0] >= 0)
+                fab->set_capacity(0, 0, fab->get_width(), fab->get_height(), v[0]);
+            else if (ok && v.size() == 5 && valid_region(v, fab) && v[4] >= 0)
+                fab->set_capacity(v[0], v[1], v[2], v[3], v[4]);
+            else
+                ok = false;
+        } else if (key == "obstruction") {
+            ok = ok && v.size() == 4 && valid_region(v, fab);
+            if (ok)
+                fab->mark_obstruction(v[0], v[1], v[2], v[3]);
+        } else {
+            ok = false;
+        }
+
+        if (!ok) {
+            spdlog::error("{}:{}: bad fabric spec line '{}'", file, lineno, line);
+            delete fab;
+            return nullptr;
+        }
+    }
+
+    if (fab == nullptr) {
+        spdlog::error("{}: fabric spec has no size", file);
+        return nullptr;
+    }
+    spdlog::info("Loaded {}x{} fabric from {}", fab->get_width(), fab->get_height(), file);
+    return fab;
 }
 
 bin* fabric::get_bin(int x, int y) {
-    return bins[x][y]; 
+    return &bins[bin_index(x,y)];
+}
+
+// the bin a cell was mapped or moved to, nullptr if it is not on the fabric
+bin* fabric::get_cell_bin(cell* c) {
+    auto it = cell_bins.find(c);
+    if (it == cell_bins.end())
+        return nullptr;
+    return it->second;
+}
+
+// only the width x height grid is scanned for overflow, the extra row and
+// column from the constructor are not
+bool fabric::in_grid(bin* b) {
+    return b->x < width && b->y < height;
+}
+
+// every change to a bin's occupancy goes through here so the overflow set
+// stays keyed by the current supply
+void fabric::update_overflow(bin* b, double old_supply) {
+    double new_supply = b->supply();
+    if (new_supply == old_supply || !in_grid(b))
+        return;
+    if (old_supply > 0)
+        overflow_set.erase(make_pair(old_supply, b->id));
+    if (new_supply > 0)
+        overflow_set.insert(make_pair(new_supply, b->id));
+    overflow_sum += new_supply - old_supply;
+}
+
+// bins themselves are only touched by one thread at a time (see
+// schedule_waves); the lookup tables shared by all bins need the lock
+void fabric::add_cell_to_bin(bin* b, cell* c) {
+    double old_supply = b->supply();
+    b->cells.push_back(c);
+    b->used += c->get_area();
+    if (c->is_fixed())
+        b->fixed_used += c->get_area();
+    lock_guard<mutex> lk(occupancy_lock);
+    cell_bins[c] = b;
+    ++cell_moves;
+    update_overflow(b, old_supply);
+}
+
+void fabric::remove_cell_from_bin(bin* b, vector<cell*>::iterator it) {
+    double old_supply = b->supply();
+    cell* c = *it;
+    b->cells.erase(it);
+    // don't let rounding build up in bins that empty out
+    b->used = b->cells.empty() ? 0. : b->used - c->get_area();
+    if (c->is_fixed())
+        b->fixed_used = b->cells.empty() ? 0. : b->fixed_used - c->get_area();
+    lock_guard<mutex> lk(occupancy_lock);
+    cell_bins.erase(c);
+    update_overflow(b, old_supply);
+}
+
+// for moves outside the flow, e.g. detailed placement. no capacity checks
+void fabric::move_cell_to_bin(cell* c, bin* to) {
+    bin* from = get_cell_bin(c);
+    if (from == to)
+        return;
+    if (from != nullptr)
+        remove_cell_from_bin(from, find(from->cells.begin(), from->cells.end(), c));
+    add_cell_to_bin(to, c);
 }
 
 void fabric::foreach_bin(void (*fn)(bin* b)) {
@@ -50,11 +203,30 @@ void fabric::foreach_bin(void (*fn)(bin* b)) {
     } 
 }
 
+// capacity of every bin in the (inclusive) region; cells already mapped
+// there are re-counted against the new capacity
+void fabric::set_capacity(int x0, int y0, int x1, int y1, double c) {
+    for(int i = max(0, x0); i <= min(x1, width); ++i) {
+        for(int j = max(0, y0); j <= min(y1, height); ++j) {
+            bin* b = get_bin(i,j);
+            double old_supply = b->supply();
+            b->capacity = c;
+            update_overflow(b, old_supply);
+        }
+    }
+}
+
+// the region is clipped to the grid; the pad row and column past it are
+// never obstructed
 void fabric::mark_obstruction(int x0, int y0, int x1, int y1) {
-    int x0p = min(x0, width);
-    int x1p = min(x1, width);
-    int y0p = min(y0, height);
-    int y1p = min(y1, height);
+    if (x0 >= width || y0 >= height || x1 < 0 || y1 < 0) {
+        spdlog::warn("obstruction {},{},{},{} is off the fabric, ignoring", x0, y0, x1, y1);
+        return;
+    }
+    int x0p = max(0, min(x0, width-1));
+    int x1p = max(0, min(x1, width-1));
+    int y0p = max(0, min(y0, height-1));
+    int y1p = max(0, min(y1, height-1));
 
     if (x0p != x0)
         spdlog::warn("invalid x0, truncating");
@@ -67,48 +239,185 @@ void fabric::mark_obstruction(int x0, int y0, int x1, int y1) {
 
     for(int i = x0p; i <= x1p; ++i) {
         for(int j = y0p; j <= y1p; ++j) {
-            bins[i][j]->usable=false;
+            get_bin(i,j)->usable=false;
+            nearest_valid = false;
         }
     }
 }
 
+// rounds a solved coordinate to a bin index in [0, hi]. Solutions can
+// land off the fabric (far pads, a big fixed weight bias), those go to the
+// edge; NaN goes to 0
+static int clamp_to_grid(double v, int hi, bool* clamped) {
+    if (v != v || v < -0.5) {
+        *clamped = true;
+        return 0;
+    }
+    if (v >= hi + 0.5) {
+        *clamped = true;
+        return hi;
+    }
+    return (int)floor(v + 0.5);
+}
+
 void fabric::map_cells(vector<cell*> cells) {
+    int n_clamped = 0;
     for(auto& c: cells) {
         pair<double,double> coords = c->get_coords();
         
-        int x = round(get<0>(coords));
-        int y = round(get<1>(coords));
-        bin* b = bins[x][y];
+        // pads may sit on the extra row and column past the grid, but the
+        // flow never spreads anything there, so movable cells stay inside
+        bool clamped = false;
+        int x = clamp_to_grid(get<0>(coords), c->is_fixed() ? width : width-1, &clamped);
+        int y = clamp_to_grid(get<1>(coords), c->is_fixed() ? height : height-1, &clamped);
+        if (clamped) {
+            spdlog::debug("cell {} at {},{} is off the fabric, using {},{}", c->label,
+                get<0>(coords), get<1>(coords), x, y);
+            ++n_clamped;
+        }
+        bin* b = get_bin(x,y);
         if (b->usable)
-            bins[x][y]->cells.push_back(c);
+            add_cell_to_bin(b, c);
         else {
-            double smallest_dist = 0.;
-            bool first = true;
-            bin* smallest;
-            for(int i = 0; i < width; ++i){
-                for(int j = 0; j < height; ++j){
-                    b = bins[i][j]; 
-                    if (b->usable) {
-                        double newdist = distance_cell_to_bin(c, b);
-                        if (newdist < smallest_dist || first) {
-                            first = false;
-                            smallest_dist = newdist;
-                            smallest = b;
-                        }
-                    }
-                }
+            bin* nearest = get_nearest_usable_bin(b);
+            if (nearest == nullptr) {
+                spdlog::error("No usable bin for cell {}", c->label);
+                continue;
             }
-            smallest->cells.push_back(c);
+            add_cell_to_bin(nearest, c);
+        }
+    }
+    if (n_clamped > 0)
+        spdlog::warn("{} cells were off the fabric and mapped to its edge", n_clamped);
+}
+
+// squared distance transform of f along one line (Felzenszwalb and
+// Huttenlocher, "Distance Transforms of Sampled Functions"): d[q] is the
+// min over p of (q-p)^2 + f[p], and arg[q] the p it came from (-1 when
+// every f[p] is infinite). v and z are the parabolas of the lower envelope
+// and the boundaries between them
+static void distance_transform_1d(const vector<double>& f, vector<double>& d, vector<int>& arg) {
+    const double inf = numeric_limits<double>::infinity();
+    int n = f.size();
+    vector<int> v(n);
+    vector<double> z(n+1);
+    int k = -1;
+    for (int q = 0; q < n; ++q) {
+        if (f[q] == inf)
+            continue;
+        double s = -inf;
+        while (k >= 0) {
+            s = ((f[q] + (double)q*q) - (f[v[k]] + (double)v[k]*v[k])) / (2.*q - 2.*v[k]);
+            if (s > z[k])
+                break;
+            --k;
         }
+        if (k < 0)
+            s = -inf;
+        ++k;
+        v[k] = q;
+        z[k] = s;
+        z[k+1] = inf;
+    }
+
+    d.assign(n, inf);
+    arg.assign(n, -1);
+    if (k < 0)
+        return;
+    k = 0;
+    for (int q = 0; q < n; ++q) {
+        while (z[k+1] < q)
+            ++k;
+        d[q] = (double)(q - v[k])*(q - v[k]) + f[v[k]];
+        arg[q] = v[k];
     }
 }
 
-bool fn_sort_candidate_paths(queue<bin*> i, queue<bin*> j) {
-    // compare cost
-    // need last element and first element
-    double cost_i = compute_cost(i.front(), i.back());
-    double cost_j = compute_cost(j.front(), j.back());
-    return cost_i < cost_j;
+// for every bin, the usable bin whose centre is nearest its centre, as an
+// exact euclidean distance transform: one pass down each column, then one
+// along each row over the column results. O(bins), redone only after
+// mark_obstruction. Like the rest of the flow only the width x height grid
+// is a target
+void fabric::build_nearest_usable() {
+    const double inf = numeric_limits<double>::infinity();
+    int nx = width+1, ny = height+1;
+    vector<double> f, d;
+    vector<int> arg;
+
+    // nearest usable y in each column
+    vector<double> col_d(bins.size());
+    vector<int> col_arg(bins.size());
+    f.resize(ny);
+    for (int i = 0; i < nx; ++i) {
+        for (int j = 0; j < ny; ++j) {
+            f[j] = (i < width && j < height && get_bin(i,j)->usable) ? 0. : inf;
+        }
+        distance_transform_1d(f, d, arg);
+        for (int j = 0; j < ny; ++j) {
+            col_d[bin_index(i,j)] = d[j];
+            col_arg[bin_index(i,j)] = arg[j];
+        }
+    }
+
+    // then the nearest of those along each row
+    nearest_usable.assign(bins.size(), -1);
+    f.resize(nx);
+    for (int j = 0; j < ny; ++j) {
+        for (int i = 0; i < nx; ++i) {
+            f[i] = col_d[bin_index(i,j)];
+        }
+        distance_transform_1d(f, d, arg);
+        for (int i = 0; i < nx; ++i) {
+            if (arg[i] >= 0)
+                nearest_usable[bin_index(i,j)] = bin_index(arg[i], col_arg[bin_index(arg[i],j)]);
+        }
+    }
+    nearest_valid = true;
+}
+
+// nullptr only if nothing on the fabric is usable
+bin* fabric::get_nearest_usable_bin(bin* b) {
+    if (!nearest_valid)
+        build_nearest_usable();
+    int k = nearest_usable[b->id];
+    return k >= 0 ? &bins[k] : nullptr;
+}
+
+/**** 
+ * path_set functions
+ ****/
+
+void path_set::clear() {
+    pool.clear();
+    spans.clear();
+}
+
+// appends an empty path; bins are then pushed with push_bin
+void path_set::begin_path() {
+    spans.push_back(make_pair((int)pool.size(), 0));
+}
+
+void path_set::push_bin(bin* b) {
+    pool.push_back(b);
+    spans.back().second++;
+}
+
+// orders paths by the cost between their first and last bins
+struct fn_sort_candidate_paths {
+    path_set* ps;
+    bool operator()(const pair<int,int>& i, const pair<int,int>& j) {
+        // compare cost
+        // need last element and first element
+        bin** pi = &ps->pool[i.first];
+        bin** pj = &ps->pool[j.first];
+        double cost_i = compute_cost(pi[0], pi[i.second-1]);
+        double cost_j = compute_cost(pj[0], pj[j.second-1]);
+        return cost_i < cost_j;
+    }
+};
+
+void path_set::sort_by_cost() {
+    sort(spans.begin(), spans.end(), fn_sort_candidate_paths{this});
 }
 
 double distance_cell_to_bin(cell* i, bin* j) {
@@ -122,17 +431,28 @@ double distance_cell_to_bin(cell* i, bin* j) {
     return sqrt(dx*dx + dy*dy);
 }
 
-bin* g_nearest_ref;
-bool fn_sort_nearest(cell* i, cell* j) {
-    return (distance_cell_to_bin(i,g_nearest_ref) < distance_cell_to_bin(j,g_nearest_ref));
-}
+// orders cells by distance to a reference bin
+struct fn_sort_nearest {
+    bin* ref;
+    bool operator()(cell* i, cell* j) {
+        return (distance_cell_to_bin(i,ref) < distance_cell_to_bin(j,ref));
+    }
+};
 
 void fabric::move_along_path(queue<bin*> path, double psi) {
+    vector<bin*> p;
+    while(!path.empty()) {
+        p.push_back(path.front()); path.pop();
+    }
+    move_along_path(p.data(), p.size(), psi);
+}
+
+void fabric::move_along_path(bin** path, int len, double psi) {
     stack<bin*> S;
-    bin* vsrc = path.front(); path.pop();
+    bin* vsrc = path[0];
     S.push(vsrc);
-    while(!path.empty()) {
-        bin* vsink = path.front(); path.pop(); // starts with an empty bin
+    for(int k = 1; k < len; ++k) {
+        bin* vsink = path[k]; // starts with an empty bin
         double cost = compute_cost(vsrc,vsink);
         if (cost < psi) {
             S.push(vsink);
@@ -140,35 +460,91 @@ void fabric::move_along_path(queue<bin*> path, double psi) {
             return;
         }
     }
+    // each bin takes the nearest cell that fits in the room it has: its
+    // free area at the end of the path, and further up whatever it just
+    // gave away (so it ends up no fuller than it started)
     bin* vsink = S.top(); S.pop();
+    double room = vsink->free_area();
     while(!S.empty()) {
         vsrc = S.top(); S.pop();
-        vector<cell*> cells = vector<cell*>(vsrc->cells);
-        g_nearest_ref = vsink;
-        sort(vsrc->cells.begin(), vsrc->cells.end(), fn_sort_nearest);
-        spdlog::debug("moving cell {} from {},{} to {},{}",vsrc->cells[0]->label, 
+        sort(vsrc->cells.begin(), vsrc->cells.end(), fn_sort_nearest{vsink});
+        auto it = vsrc->cells.begin();
+        while (it != vsrc->cells.end() && ((*it)->is_fixed() || (*it)->get_area() > room + AREA_EPS))
+            ++it;
+        if (it == vsrc->cells.end()) {
+            spdlog::debug("no cell in {},{} fits in {},{}", vsrc->x, vsrc->y, vsink->x, vsink->y);
+            return;
+        }
+        cell* c = *it;
+        spdlog::debug("moving cell {} from {},{} to {},{}",c->label, 
             vsrc->x, vsrc->y,
             vsink->x, vsink->y
             );
-        vsink->cells.push_back(vsrc->cells[0]);        
-        vsrc->cells.erase(vsrc->cells.begin());
+        remove_cell_from_bin(vsrc, it);
+        add_cell_to_bin(vsink, c);
+        room = max(vsrc->free_area(), c->get_area());
         vsink = vsrc;
     }
 }
 
+// the flow can only end if every movable cell fits in some bin and all of
+// them fit in the room the usable bins have left next to the fixed cells.
+// checked before a flow starts, so an impossible spread is an error rather
+// than a flow that never ends. passing doesn't promise a legal result, see
+// flow_stalled
+bool fabric::check_capacity() {
+    double room = 0., largest = 0.;
+    for(auto& b : bins) {
+        if (!b.usable || !in_grid(&b))
+            continue;
+        double r = max(0., b.capacity - b.fixed_used);
+        room += r;
+        largest = max(largest, r);
+    }
+    double area = 0.;
+    for(auto& e : cell_bins) {
+        cell* c = e.first;
+        if (c->is_fixed())
+            continue;
+        if (c->get_area() > largest + AREA_EPS) {
+            spdlog::error("cell {} has area {}, no bin has more than {} free", c->label, c->get_area(), largest);
+            return false;
+        }
+        area += c->get_area();
+    }
+    if (area > room + AREA_EPS) {
+        spdlog::error("movable cell area {} is more than the {} the fabric has free", area, room);
+        return false;
+    }
+    return true;
+}
+
+// once psi reaches across the whole fabric, a round that moves no cell
+// leaves the bins as they were, and so will every round after it
+bool fabric::flow_stalled(unsigned long moves_before, double psi) {
+    double reach = (double)(width-1)*(width-1) + (double)(height-1)*(height-1);
+    if (cell_moves != moves_before || psi <= reach)
+        return false;
+    spdlog::error("flow stalled with {} overflow left in {} bins", overflow_sum, overflow_set.size());
+    return true;
+}
+
 bool fabric::run_flow_step(flow_state* fs) {
     //micro state...
     // just keep calling this concurrently to advance
-    static int state = 0;
-    static int bin_idx = 0;
-    static int path_idx = 0;
-    static bin* bi;
-    queue<bin*> pk;
+    // all of it lives in fs, so independent flows can run side by side
+    int& state = fs->state;
+    int& bin_idx = fs->bin_idx;
+    int& path_idx = fs->path_idx;
+    bin*& bi = fs->bi;
 
     if (!fs->done_flow) {
         switch(state) {
             case 0: // init overflowed bins only once
+                if (fs->iter == 0)
+                    fs->failed = !check_capacity();
                 fs->overflowed_bins = get_overused_bins();
+                fs->round_moves = cell_moves;
                 bin_idx = 0;
                 if (!fs->overflowed_bins.empty()) {
                     state = 1;
@@ -177,16 +553,15 @@ bool fabric::run_flow_step(flow_state* fs) {
 
             case 1: // get candidate paths
                 bi = fs->overflowed_bins[bin_idx];
-                fs->P = find_candidate_paths( bi, fs->psi());
-                sort(fs->P.begin(), fs->P.end(), fn_sort_candidate_paths);
+                find_candidate_paths(bi, fs->psi(), &fs->P);
+                fs->P.sort_by_cost();
                 state = 2;
                 break;
 
             case 2: // move along paths
-                if (!fs->P.empty()) {
-                    pk = fs->P[path_idx];
+                if (fs->P.size() > 0) {
                     if (bi->supply() > 0) {
-                        move_along_path(pk, fs->psi());
+                        move_along_path(fs->P.begin(path_idx), fs->P.length(path_idx), fs->psi());
                     }
                     path_idx++;
                 }
@@ -195,6 +570,8 @@ bool fabric::run_flow_step(flow_state* fs) {
                     path_idx = 0;
                     bin_idx++;
                     if (bin_idx == fs->overflowed_bins.size()) {
+                        if (flow_stalled(fs->round_moves, fs->psi()))
+                            fs->failed = true;
                         bin_idx = 0;
                         state = 0;
                         fs->iter++;
@@ -206,18 +583,198 @@ bool fabric::run_flow_step(flow_state* fs) {
                 break;
         }
 
-        if (get_overused_bins().empty()) {
+        if (overflow_set.empty() || fs->failed) {
+            // ready for the next flow on this fabric
+            state = 0;
+            bin_idx = 0;
+            path_idx = 0;
             fs->done_flow = true;
             calculate_total_displacement();
-            spdlog::info("FLOW DONE");
+            if (!fs->failed)
+                spdlog::info("FLOW DONE");
         }
     }
-    return get_overused_bins().empty();
+    return fs->done_flow;
 
 }
 
-bool fn_sort_bin_supply(bin* i, bin* j) {
-    return i->supply() < j->supply();
+void fabric::run_flow(flow_state* fs) {
+    spdlog::debug("Running entire flow");
+    if (fs->threads > 1) {
+        run_flow_parallel(fs);
+        return;
+    }
+    while(!run_flow_step(fs));
+}
+
+// what run_flow_step does for one overflowed bin, all in one go
+void fabric::spread_bin(bin* bi, double psi, search_context* ctx, path_set* P) {
+    find_candidate_paths(bi, psi, P, ctx);
+    P->sort_by_cost();
+    for(int k = 0; k < P->size() && bi->supply() > 0; ++k) {
+        move_along_path(P->begin(k), P->length(k), psi);
+    }
+}
+
+// a search from a bin only reads and moves cells in bins with
+// compute_cost < psi, i.e. within sqrt(psi) of it in x and y
+struct search_box {
+    int x0, y0, x1, y1;
+    bool overlaps(const search_box& o) const {
+        return x0 <= o.x1 && o.x0 <= x1 && y0 <= o.y1 && o.y0 <= y1;
+    }
+};
+
+// splits the overflowed bins (in the order run_flow_step would visit them)
+// into waves of bins whose search boxes don't overlap. Each bin goes in the
+// wave after the last one holding an earlier bin it overlaps, so running
+// the waves in order, with the bins of a wave in any order, gives exactly
+// the sequential result. Boxes are bucketed on a grid of box-sized cells,
+// so each box touches at most 2x2 buckets and is only compared with the
+// boxes already in them
+vector<vector<bin*>> fabric::schedule_waves(vector<bin*> order, double psi) {
+    int r = psi > 0. ? (int)ceil(sqrt(psi)) : 0;
+    int side = 2*r + 1;
+    int nbx = (width + side - 1) / side;
+    int nby = (height + side - 1) / side;
+    vector<vector<int>> buckets(nbx * nby);
+    vector<search_box> boxes;
+    vector<int> wave_of;
+    vector<vector<bin*>> waves;
+
+    for(auto* b : order) {
+        search_box box = {max(0, (int)b->x - r), max(0, (int)b->y - r),
+                          min(width-1, (int)b->x + r), min(height-1, (int)b->y + r)};
+        int w = 0;
+        for(int i = box.x0 / side; i <= box.x1 / side; ++i) {
+            for(int j = box.y0 / side; j <= box.y1 / side; ++j) {
+                for(int k : buckets[i*nby + j]) {
+                    if (wave_of[k] >= w && box.overlaps(boxes[k]))
+                        w = wave_of[k] + 1;
+                }
+            }
+        }
+        int id = boxes.size();
+        boxes.push_back(box);
+        wave_of.push_back(w);
+        for(int i = box.x0 / side; i <= box.x1 / side; ++i) {
+            for(int j = box.y0 / side; j <= box.y1 / side; ++j) {
+                buckets[i*nby + j].push_back(id);
+            }
+        }
+        if (w == (int)waves.size())
+            waves.emplace_back();
+        waves[w].push_back(b);
+    }
+    return waves;
+}
+
+// worker threads that stay up for a whole flow and are handed one wave at
+// a time. The calling thread works on each wave too, as worker 0
+struct wave_workers {
+    int n;
+    function<void(int, vector<bin*>*)> work;
+    vector<thread> threads;
+    mutex m;
+    condition_variable cv_start;
+    condition_variable cv_done;
+    vector<bin*>* wave;
+    unsigned generation;
+    int busy;
+    bool quit;
+
+    wave_workers(int _n, function<void(int, vector<bin*>*)> _work)
+        : n(_n), work(_work), wave(nullptr), generation(0), busy(0), quit(false) {
+        for(int t = 1; t < n; ++t) {
+            threads.push_back(thread(&wave_workers::loop, this, t));
+        }
+    }
+
+    ~wave_workers() {
+        {
+            lock_guard<mutex> lk(m);
+            quit = true;
+        }
+        cv_start.notify_all();
+        for(auto& th : threads) {
+            th.join();
+        }
+    }
+
+    void loop(int t) {
+        unsigned seen = 0;
+        unique_lock<mutex> lk(m);
+        for(;;) {
+            cv_start.wait(lk, [&]{ return quit || generation != seen; });
+            if (quit)
+                return;
+            seen = generation;
+            vector<bin*>* w = wave;
+            lk.unlock();
+            work(t, w);
+            lk.lock();
+            if (--busy == 0)
+                cv_done.notify_one();
+        }
+    }
+
+    // returns once every bin in w has been spread
+    void run(vector<bin*>* w) {
+        if (n == 1 || w->size() == 1) {
+            work(0, w);
+            return;
+        }
+        {
+            lock_guard<mutex> lk(m);
+            wave = w;
+            busy = n - 1;
+            ++generation;
+        }
+        cv_start.notify_all();
+        work(0, w);
+        unique_lock<mutex> lk(m);
+        cv_done.wait(lk, [&]{ return busy == 0; });
+    }
+};
+
+// same flow as run_flow, but each round's overflowed bins are spread wave
+// by wave, with the bins of a wave shared out over fs->threads threads.
+// The result does not depend on the number of threads
+void fabric::run_flow_parallel(flow_state* fs) {
+    int n_threads = max(1, fs->threads);
+    vector<search_context> ctx(n_threads);
+    vector<path_set> P(n_threads);
+    for(auto& c : ctx) {
+        c.resize(bins.size());
+    }
+
+    double psi = 0.;
+    atomic<int> next(0);
+    wave_workers workers(n_threads, [&](int t, vector<bin*>* wave) {
+        for(int k = next++; k < (int)wave->size(); k = next++) {
+            spread_bin((*wave)[k], psi, &ctx[t], &P[t]);
+        }
+    });
+
+    fs->failed = !check_capacity();
+    while (!fs->failed && !overflow_set.empty()) {
+        psi = fs->psi();
+        unsigned long moves_before = cell_moves;
+        vector<vector<bin*>> waves = schedule_waves(get_overused_bins(), psi);
+        spdlog::debug("flow round {}: {} waves", fs->iter, waves.size());
+
+        for(auto& wave : waves) {
+            next = 0;
+            workers.run(&wave);
+        }
+        fs->failed = flow_stalled(moves_before, psi);
+        fs->iter++;
+    }
+
+    fs->done_flow = true;
+    calculate_total_displacement();
+    if (!fs->failed)
+        spdlog::info("FLOW DONE");
 }
 
 vector<bin*> fabric::get_neighbours(bin* b) {
@@ -246,42 +803,83 @@ static double compute_cost(bin* bi, bin* bk) {
     return (dx*dx) + (dy*dy);
 }
 
-vector<queue<bin*>> fabric::find_candidate_paths(bin* bi, double psi) {
-    vector<queue<bin*>> P; // these are complete paths
-    queue<queue<bin*>> paths; // this is our working FIFO of paths
+/**** 
+ * search_context functions
+ ****/
+
+void search_context::resize(int n_bins) {
+    visit_stamp.assign(n_bins, 0);
+    visit_parent.assign(n_bins, -1);
+    epoch = 0;
+}
 
-    int demand = 0; // total demand we've built while generating paths
+// starts a new search over visit_stamp; stamps are only cleared when the
+// epoch counter wraps
+unsigned search_context::next_epoch() {
+    if (++epoch == 0) {
+        fill(visit_stamp.begin(), visit_stamp.end(), 0);
+        epoch = 1;
+    }
+    return epoch;
+}
 
-    map<bin*,bool> bins_visited;
-    // semantics: if it isnt in the map, it hasnt been visited
-    bins_visited[bi] = true;
+path_set fabric::find_candidate_paths(bin* bi, double psi) {
+    path_set P;
+    find_candidate_paths(bi, psi, &P);
+    return P;
+}
+
+void fabric::find_candidate_paths(bin* bi, double psi, path_set* P) {
+    find_candidate_paths(bi, psi, P, &search);
+}
+
+// breadth first search out from bi. Each visited bin only records the bin
+// it was reached from; the complete paths (ending in an empty bin) are
+// walked back through those links into P once the search is over
+void fabric::find_candidate_paths(bin* bi, double psi, path_set* P, search_context* ctx) {
+    vector<unsigned>& visit_stamp = ctx->visit_stamp;
+    vector<int>& visit_parent = ctx->visit_parent;
+    queue<int> paths; // working FIFO, the tail bin of each partial path
+    vector<int> ends; // last bin of each complete path
+
+    double demand = 0.; // total free area we've found while generating paths
+
+    // a path is only worth having if its end can take at least the
+    // smallest movable cell in bi
+    double min_area = -1.;
+    for(size_t k = 0; k < bi->cells.size(); ++k) {
+        double a = bi->cells[k]->get_area();
+        if (!bi->cells[k]->is_fixed() && (min_area < 0. || a < min_area))
+            min_area = a;
+    }
+
+    // a bin has been visited in this search if its stamp is the current epoch
+    unsigned epoch = ctx->next_epoch();
+    visit_stamp[bi->id] = epoch;
+    visit_parent[bi->id] = -1;
     
     spdlog::debug("overflowed bi @ {},{}", bi->x, bi->y);
-    queue<bin*> first_path; 
-    first_path.push(bi);
-    paths.push(first_path);
+    paths.push(bi->id);
 
     while ((!paths.empty()) && demand < bi->supply()) {
-        queue<bin*> p;
-        p = paths.front(); paths.pop();
-
         // get possible next paths
-        bin* tailbin = p.back();
-        vector<bin*> neighbours = get_neighbours(tailbin);
+        int tail = paths.front(); paths.pop();
+        vector<bin*> neighbours = get_neighbours(&bins[tail]);
         for(auto& bk : neighbours) {
             spdlog::debug("checking out bk @ {},{}", bk->x, bk->y);
-            if (bins_visited.find(bk) == bins_visited.end()) { // if not visited
-                bins_visited[bk] = true;
+            if (visit_stamp[bk->id] != epoch) { // if not visited
+                visit_stamp[bk->id] = epoch;
                 double cost = compute_cost(bi, bk);
                 if (cost < psi) {
-                    queue<bin*> pcopy = queue<bin*>(p);
-                    pcopy.push(bk);
-
-                    if (bk->cells.empty()) {
-                        P.push_back(pcopy);
-                        demand++;
-                    } else {
-                        paths.push(pcopy);
+                    visit_parent[bk->id] = tail;
+
+                    // paths end at bins with room to spare and run
+                    // through full bins that have a movable cell to pass on
+                    if (bk->free_area() > 0. && bk->free_area() >= min_area - AREA_EPS) {
+                        ends.push_back(bk->id);
+                        demand += bk->free_area();
+                    } else if (bk->usage() - bk->fixed_used > AREA_EPS) {
+                        paths.push(bk->id);
                     }
 
                 } else {
@@ -290,49 +888,81 @@ vector<queue<bin*>> fabric::find_candidate_paths(bin* bi, double psi) {
             }
         }
     }
-    
-    return P;
-}
 
-void fabric::calculate_total_displacement() {
-    // for each block, 
-    // find the x,y it started at,
-    // and then find the x,y it ended up at
-    // sum (abs(dx) + abs(dy)) for all cells
+    P->clear();
+    for(int e : ends) {
+        P->begin_path();
+        int first = P->pool.size();
+        for(int k = e; k != -1; k = visit_parent[k]) {
+            P->push_bin(&bins[k]);
+        }
+        reverse(P->pool.begin() + first, P->pool.end());
+    }
+}
 
-    unsigned long long result = 0;
+// sum of |dx| + |dy| between each cell's rounded solved position and the
+// bin it was spread to. the cell ids and bin coordinates are laid out
+// flat so the kernel can gather the solved positions straight from the
+// netlist's coordinate arrays
+unsigned long long fabric::calculate_total_displacement() {
+    vector<int> ids;
+    vector<double> bx, by;
+    netlist* nl = nullptr;
+    double result = 0.;
 
     for(int i = 0; i < width; i++) {
         for(int j = 0; j < height; j++) {
             bin* b = get_bin(i,j);
             for(auto& c : b->cells) {
+                if (c->get_netlist() != nullptr && (nl == nullptr || c->get_netlist() == nl)) {
+                    nl = c->get_netlist();
+                    ids.push_back(c->id);
+                    bx.push_back(b->x);
+                    by.push_back(b->y);
+                    continue;
+                }
+                // cells outside a netlist keep their own coordinates
                 pair<double,double> coords = c->get_coords();
-                int x0 = round(get<0>(coords));
-                int y0 = round(get<1>(coords));
-                int x1 = b->x;
-                int y1 = b->y;
-                result += abs(x1-x0) + abs(y1-y0);
+                result += fabs(round(get<0>(coords)) - b->x) + fabs(round(get<1>(coords)) - b->y);
             }
         }
     }
-    spdlog::info("Total displacement: {}", result);
+    if (nl != nullptr) {
+        result += gather_round_abs_diff(nl->xs.data(), ids.data(), bx.data(), ids.size());
+        result += gather_round_abs_diff(nl->ys.data(), ids.data(), by.data(), ids.size());
+    }
+    spdlog::info("Total displacement: {}", (unsigned long long)result);
+    return result;
 }
 
+// overused bins in order of increasing oversupply, read straight off the
+// overflow set
 vector<bin*> fabric::get_overused_bins() {
     vector<bin*> result;
-    for(int i = 0; i < width; i++) {
-        for(int j = 0; j < height; j++) {
-            bin* b = get_bin(i,j);
-            if (b->supply() > 0)
-                result.push_back(b);
-        }
-    } 
-
-    // sort by amount of oversupply
-    sort(result.begin(), result.end(), fn_sort_bin_supply);
+    result.reserve(overflow_set.size());
+    for(auto& e : overflow_set) {
+        result.push_back(&bins[e.second]);
+    }
     return result;
 }
 
+// total supply of the overused bins, i.e. how many cells overlap
+double fabric::total_overflow() {
+    return overflow_sum;
+}
+
+// takes every cell off the fabric, e.g. before mapping a new solution
+void fabric::clear_cells() {
+    for(auto& b : bins) {
+        b.cells.clear();
+        b.used = 0.;
+        b.fixed_used = 0.;
+    }
+    cell_bins.clear();
+    overflow_set.clear();
+    overflow_sum = 0;
+}
+
 vector<bin*> fabric::get_used_bins() {
     vector<bin*> result;
     for(int i = 0; i < width; i++) {
@@ -4,6 +4,9 @@
 #include <algorithm>
 #include <stack>
 #include <queue>
+#include <unordered_map>
+#include <set>
+#include <mutex>
 #include "circuit.h"
 #include "psis.h"
 
@@ -12,56 +15,133 @@ using namespace std;
 class cell;
 class fabric;
 
+// cell areas are summed as doubles, anything within this is treated as
+// an exact fit
+#define AREA_EPS 1e-9
+
+// capacity, usage, supply and free area are all cell area, in units of
+// one bin
 struct bin {
+    int id;     // index into fabric::bins
     double x;
     double y;
-    int capacity;
+    double capacity;
     bool usable;
     vector<cell*> cells;
-    int supply() {return max(0, usage() - capacity);};
-    //int demand() {return 0.;};
-    int usage() {return cells.size();};
+    double used;    // total area of cells, kept up to date by fabric
+    double fixed_used;  // the part of used that is fixed cells, which stay put
+    // fixed cells piled up beyond capacity can't be spread, so they don't count
+    double supply() {double s = usage() - max(capacity, fixed_used); return s > AREA_EPS ? s : 0.;};
+    double free_area() {double f = capacity - usage(); return f > AREA_EPS ? f : 0.;};
+    double usage() {return used;};
     double map_cell(cell* c);
     void remove_cell(cell* c);
 };
 
+// candidate paths out of one overflowed bin. All paths share one pool of
+// bins; path k is pool[spans[k].first] onwards for spans[k].second bins,
+// starting at the overflowed bin
+struct path_set {
+    vector<bin*> pool;
+    vector<pair<int,int>> spans;
+    int size() {return spans.size();};
+    int length(int k) {return spans[k].second;};
+    bin** begin(int k) {return &pool[spans[k].first];};
+    bin** end(int k) {return begin(k) + length(k);};
+    void clear();
+    void begin_path();
+    void push_bin(bin* b);
+    void sort_by_cost();
+};
+
+// scratch space for one candidate path search; each thread spreading bins
+// in parallel has its own
+struct search_context {
+    vector<unsigned> visit_stamp;   // per bin id, see next_epoch
+    vector<int> visit_parent;       // per bin id, previous bin on the search path
+    unsigned epoch;
+    void resize(int n_bins);
+    unsigned next_epoch();
+};
+
 struct flow_state {
     int iter;
     bool step;
     psi_params h;
     double (*psi_fn)(int iter, psi_params* h);
+    int threads;            // > 1: run_flow spreads independent bins in parallel
     bool done_flow;
     bool done_spread;
-    vector<queue<bin*>> P;  // candidate paths
+    bool failed;            // the flow gave up with overflow left, see check_capacity
+    path_set P;             // candidate paths
     vector<bin*> overflowed_bins;  
+
+    // run_flow_step position: state machine state, current overflowed
+    // bin and candidate path
+    int state;
+    int bin_idx;
+    int path_idx;
+    bin* bi;
+    unsigned long round_moves;  // fabric cell moves when the round started
     double psi();
 };
 
 // path - is it just a list of bins?
-// . Each path is a queue of bins whose first element is the overflowed bin λi . 
+// . Each path is a list of bins whose first element is the overflowed bin λi . 
 
 class fabric {
     private:
-        bin*** bins;
+        vector<bin> bins;   // (width+1)*(height+1), see bin_index
         int width, height;
+        int bin_index(int x, int y) { return x*(height+1) + y; }
+        unordered_map<cell*, bin*> cell_bins;   // kept in step with bin::cells
+        set<pair<double,int>> overflow_set;     // (supply, bin id) of overused bins
+        double overflow_sum;                    // total supply over overflow_set
+        unsigned long cell_moves;               // cells added to bins so far, see flow_stalled
+        bool in_grid(bin* b);
+        void update_overflow(bin* b, double old_supply);
+        void add_cell_to_bin(bin* b, cell* c);
+        void remove_cell_from_bin(bin* b, vector<cell*>::iterator it);
+        mutex occupancy_lock;                   // guards cell_bins and the overflow set
+        search_context search;                  // for searches on the calling thread
+        vector<int> nearest_usable;             // per bin id, see build_nearest_usable
+        bool nearest_valid;
+        void build_nearest_usable();
+        vector<vector<bin*>> schedule_waves(vector<bin*> order, double psi);
+        void spread_bin(bin* bi, double psi, search_context* ctx, path_set* P);
+        bool check_capacity();
+        bool flow_stalled(unsigned long moves_before, double psi);
     public:
         double spread_weight;
         fabric(int x, int y);
-        ~fabric();
+        int get_width() {return width;};
+        int get_height() {return height;};
         void mark_obstruction(int x0, int y0, int x1, int y1);
+        void set_capacity(int x0, int y0, int x1, int y1, double c);
         bin* get_bin(int x, int y);
+        bin* get_cell_bin(cell* c);
+        bin* get_nearest_usable_bin(bin* b);
         void map_cells(vector<cell*> cells);
         void run_flow_iter(flow_state*);
         void foreach_bin(void (*fn)(bin* b));
         vector<bin*> get_overused_bins();
         vector<bin*> get_neighbours();
-        vector<queue<bin*>> find_candidate_paths(bin*,double);
+        path_set find_candidate_paths(bin*,double);
+        void find_candidate_paths(bin* bi, double psi, path_set* P);
+        void find_candidate_paths(bin* bi, double psi, path_set* P, search_context* ctx);
         vector<bin*> get_neighbours(bin* b);
         void move_along_path(queue<bin*> path, double psi);
+        void move_along_path(bin** path, int len, double psi);
         void run_flow(flow_state*);
+        void run_flow_parallel(flow_state*);
         bool run_flow_step(flow_state* fs);
-        void calculate_total_displacement();
+        unsigned long long calculate_total_displacement();
         vector<bin*> get_used_bins();
+        double total_overflow();
+        void clear_cells();
+        void move_cell_to_bin(cell* c, bin* to);
 };
 
+fabric* read_fabric_spec(string file);
+
 #endif
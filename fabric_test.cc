@@ -2,8 +2,14 @@
 #include <vector>
 #include <unordered_set>
 #include <utility>
+#include <thread>
+#include <chrono>
+#include <fstream>
+#include <cmath>
 #include "circuit.h"
 #include "fabric.h"
+#include "solver.h"
+#include "placer.h"
 
 TEST(Fabric, base) {
     fabric* fab = new fabric(10,10);
@@ -20,6 +26,62 @@ TEST(Fabric, base) {
     delete fab;
 }
 
+TEST(Fabric, spec_file) {
+    fabric* fab = read_fabric_spec("../data/fabric_25x25");
+    ASSERT_NE(fab, nullptr);
+    ASSERT_EQ(fab->get_width(), 25);
+    ASSERT_EQ(fab->get_height(), 25);
+    ASSERT_TRUE(fab->get_bin(1,1)->usable);
+    ASSERT_FALSE(fab->get_bin(2,2)->usable);
+    ASSERT_FALSE(fab->get_bin(9,9)->usable);
+    ASSERT_TRUE(fab->get_bin(10,9)->usable);
+    ASSERT_EQ(fab->get_bin(0,0)->capacity, 1);
+    delete fab;
+
+    string file = "fabric_spec_test";
+    ofstream out(file);
+    out << "# comment line\n"
+        << "size 40 30\n"
+        << "capacity 2\n"
+        << "capacity 0 0 4 4 3   # corner block\n"
+        << "obstruction 10 10 12 12\n"
+        << "obstruction 30 0 30 29\n";
+    out.close();
+    fab = read_fabric_spec(file);
+    ASSERT_NE(fab, nullptr);
+    ASSERT_EQ(fab->get_width(), 40);
+    ASSERT_EQ(fab->get_height(), 30);
+    ASSERT_EQ(fab->get_bin(4,4)->capacity, 3);
+    ASSERT_EQ(fab->get_bin(5,4)->capacity, 2);
+    ASSERT_FALSE(fab->get_bin(11,12)->usable);
+    ASSERT_FALSE(fab->get_bin(30,17)->usable);
+    ASSERT_TRUE(fab->get_bin(31,17)->usable);
+    delete fab;
+
+    // size has to come first, and junk is rejected
+    for (string bad : {"obstruction 1 1 2 2\nsize 10 10\n", "size 10 10\ncapacity 1 2\n",
+                       "size 10 10\nobstruction 1 1 2 x\n", "size 10\n", "# empty\n",
+                       "size 0 10\n", "size 10 -5\n"}) {
+        out.open(file);
+        out << bad;
+        out.close();
+        ASSERT_EQ(read_fabric_spec(file), nullptr) << bad;
+    }
+    ASSERT_EQ(read_fabric_spec("no_such_fabric_spec"), nullptr);
+
+    // regions have to be on the fabric, corners in order
+    for (string bad : {"size 10 10\nobstruction -1 0 3 3\n", "size 10 10\nobstruction 0 -5 1 1\n",
+                       "size 10 10\nobstruction 4 0 3 3\n", "size 10 10\ncapacity 0 4 3 3 2\n",
+                       "size 10 10\nobstruction 10 0 12 5\n", "size 10 10\nobstruction 0 10 5 10\n",
+                       "size 10 10\ncapacity 12 0 15 5 2\n"}) {
+        out.open(file);
+        out << bad;
+        out.close();
+        ASSERT_EQ(read_fabric_spec(file), nullptr) << bad;
+    }
+    remove(file.c_str());
+}
+
 TEST(Fabric, obstruction) {
     fabric* fab = new fabric(10,10);
     fab->mark_obstruction(1,1,4,4);
@@ -52,6 +114,109 @@ TEST(Fabric, obstruction) {
     ASSERT_FALSE( fab->get_bin(4,3)->usable);
     ASSERT_FALSE( fab->get_bin(4,4)->usable);
 
+    // clipped to the fabric on both sides, short of the pad row
+    fab->mark_obstruction(-5,8,0,20);
+    ASSERT_FALSE( fab->get_bin(0,8)->usable);
+    ASSERT_FALSE( fab->get_bin(0,9)->usable);
+    ASSERT_TRUE( fab->get_bin(0,10)->usable);
+    ASSERT_TRUE( fab->get_bin(1,8)->usable);
+
+    // entirely past the far edge: nothing, pads included, is obstructed
+    fab->mark_obstruction(12,0,15,5);
+    fab->mark_obstruction(0,10,3,10);
+    for (int j = 0; j <= 10; ++j)
+        ASSERT_TRUE( fab->get_bin(10,j)->usable) << j;
+    for (int i = 0; i <= 10; ++i)
+        ASSERT_TRUE( fab->get_bin(i,10)->usable) << i;
+
+    delete fab;
+}
+
+// the distance transform agrees with a brute force search from each bin
+TEST(Fabric, nearest_usable_bin) {
+    fabric* fab = new fabric(30,20);
+    fab->mark_obstruction(2,2,9,9);
+    fab->mark_obstruction(0,15,29,16);
+    fab->mark_obstruction(20,0,21,14);
+    fab->mark_obstruction(12,4,12,4);
+
+    for (int i = 0; i <= 30; ++i) {
+        for (int j = 0; j <= 20; ++j) {
+            bin* b = fab->get_bin(i,j);
+            double best = -1.;
+            for (int x = 0; x < 30; ++x) {
+                for (int y = 0; y < 20; ++y) {
+                    bin* o = fab->get_bin(x,y);
+                    double d = (x-i)*(x-i) + (y-j)*(y-j);
+                    if (o->usable && (best < 0. || d < best))
+                        best = d;
+                }
+            }
+            bin* n = fab->get_nearest_usable_bin(b);
+            ASSERT_NE(n, nullptr);
+            ASSERT_TRUE(n->usable);
+            ASSERT_LT(n->x, 30);
+            ASSERT_LT(n->y, 20);
+            double dx = n->x - i, dy = n->y - j;
+            ASSERT_EQ(dx*dx + dy*dy, best) << i << "," << j;
+        }
+    }
+
+    // obstructions added later are picked up
+    fab->mark_obstruction(10,0,29,14);
+    bin* n = fab->get_nearest_usable_bin(fab->get_bin(25,5));
+    ASSERT_TRUE(n->usable);
+    ASSERT_EQ(n->y, 17.);
+    delete fab;
+
+    fab = new fabric(3,3);
+    fab->mark_obstruction(0,0,2,2);
+    ASSERT_EQ(fab->get_nearest_usable_bin(fab->get_bin(1,1)), nullptr);
+    delete fab;
+}
+
+// solutions off the fabric go to the nearest edge bin instead of reading
+// past the bin array
+TEST(Fabric, map_cells_off_fabric) {
+    fabric* fab = new fabric(25,25);
+    fab->mark_obstruction(2,2,9,9);
+
+    vector<string> nets = {"a"};
+    vector<cell> storage(8, cell(nets));
+    double coords[8][2] = {{-3., 5.}, {40., 40.}, {12.7, -0.2}, {25.4, 3.},
+                           {-1e300, 1e300}, {NAN, 7.}, {-0.5, 24.6}, {5., -100.}};
+    double expected[8][2] = {{0., 5.}, {24., 24.}, {13., 0.}, {24., 3.},
+                             {0., 24.}, {0., 7.}, {0., 24.}, {5., 0.}};
+    vector<cell*> cells;
+    for (int k = 0; k < 8; ++k) {
+        storage[k].set_coords(coords[k][0], coords[k][1]);
+        cells.push_back(&storage[k]);
+    }
+    fab->map_cells(cells);
+    for (int k = 0; k < 8; ++k) {
+        bin* b = fab->get_cell_bin(&storage[k]);
+        ASSERT_NE(b, nullptr) << k;
+        ASSERT_EQ(b->x, expected[k][0]) << k;
+        ASSERT_EQ(b->y, expected[k][1]) << k;
+    }
+
+    // pads keep the extra row and column
+    cell edge_pad(nets), far_pad(nets);
+    edge_pad.set_coords(25., 3., true);
+    far_pad.set_coords(40., 40., true);
+    fab->map_cells({&edge_pad, &far_pad});
+    ASSERT_EQ(fab->get_cell_bin(&edge_pad), fab->get_bin(25,3));
+    ASSERT_EQ(fab->get_cell_bin(&far_pad), fab->get_bin(25,25));
+
+    // clamped into an obstruction: on to the nearest usable bin
+    cell blocked(nets);
+    blocked.set_coords(5., -50.);
+    fab->mark_obstruction(0,0,6,1);
+    fab->map_cells({&blocked});
+    bin* b = fab->get_cell_bin(&blocked);
+    ASSERT_TRUE(b->usable);
+    ASSERT_EQ(b->x, 7.);
+    ASSERT_EQ(b->y, 0.);
     delete fab;
 }
 
@@ -208,3 +373,589 @@ TEST(Fabric, move_along_path) {
 
     delete fab;
 }
+
+// the nearest cell is too big for the empty bin, so the next one goes
+TEST(Fabric, move_along_path_area) {
+    fabric* fab = new fabric(10,10);
+    fab->set_capacity(0,0,9,9,2.);
+
+    vector<string> nets = {"a"};
+    cell big(nets), small(nets), other(nets), mid(nets);
+    big.set_area(1.5);
+    small.set_area(0.5);
+    other.set_area(1.);
+    mid.set_area(2.);
+    big.set_coords(0.2,0.4);
+    small.set_coords(0.,0.);
+    other.set_coords(0.,0.);
+    mid.set_coords(1.,0.);
+    fab->map_cells({&big, &small, &other, &mid});
+    fab->set_capacity(2,0,2,0,0.5);
+
+    bin* b00 = fab->get_bin(0,0);
+    bin* b10 = fab->get_bin(1,0);
+    bin* b20 = fab->get_bin(2,0);
+    ASSERT_EQ(b00->supply(), 1.);
+    ASSERT_EQ(b10->free_area(), 0.);
+    ASSERT_EQ(b20->free_area(), 0.5);
+
+    // mid can't go to (2,0); nothing moves
+    queue<bin*> pk;
+    pk.push(b00);
+    pk.push(b10);
+    pk.push(b20);
+    fab->move_along_path(pk, 99999.);
+    ASSERT_EQ(b10->cells.size(), 1);
+    ASSERT_TRUE(b20->cells.empty());
+
+    // (0,1) takes the nearest cell that fits in a bin of 2, then 1.5 is over
+    bin* b01 = fab->get_bin(0,1);
+    queue<bin*> pk2;
+    pk2.push(b00);
+    pk2.push(b01);
+    fab->move_along_path(pk2, 99999.);
+    ASSERT_EQ(b01->cells.size(), 1);
+    ASSERT_EQ(b01->cells[0], &big);
+    ASSERT_EQ(b00->usage(), 1.5);
+    ASSERT_EQ(b00->supply(), 0.);
+    ASSERT_EQ(fab->total_overflow(), 0.);
+    delete fab;
+}
+
+// mixed cell sizes on bins of capacity 2: the flow only stops once no
+// bin holds more area than it has
+TEST(Fabric, area_flow) {
+    fabric* fab = new fabric(12,12);
+    fab->set_capacity(0,0,12,12,2.);
+    fab->mark_obstruction(4,4,6,6);
+
+    vector<string> nets = {"a"};
+    vector<cell> storage(60, cell(nets));
+    vector<cell*> cells;
+    double total = 0.;
+    for (int k = 0; k < 60; ++k) {
+        storage[k].set_area(0.25 * (1 + k % 6));
+        storage[k].set_coords(3 + (k % 3), 3 + (k % 5) * 0.5);
+        total += storage[k].get_area();
+        cells.push_back(&storage[k]);
+    }
+    fab->map_cells(cells);
+    ASSERT_GT(fab->total_overflow(), 0.);
+
+    psi_params pps = {.a = 1.};
+    flow_state fs = {.iter = 0, .step = false, .h = pps, .psi_fn = psi_quadratic};
+    fab->run_flow(&fs);
+    ASSERT_EQ(fab->total_overflow(), 0.);
+
+    double placed = 0.;
+    for (int i = 0; i < 12; ++i) {
+        for (int j = 0; j < 12; ++j) {
+            bin* b = fab->get_bin(i,j);
+            ASSERT_LE(b->usage(), b->capacity + AREA_EPS);
+            placed += b->usage();
+        }
+    }
+    ASSERT_NEAR(placed, total, 1e-9);
+    delete fab;
+}
+
+// pads are mapped into bins but never moved: movable cells flow around
+// them, and pads piled past a bin's capacity aren't overflow
+TEST(Fabric, flow_keeps_fixed_cells) {
+    fabric* fab = new fabric(10,10);
+
+    vector<string> nets = {"a"};
+    vector<cell> storage(6, cell(nets));
+    vector<cell*> cells;
+    for (int k = 0; k < 6; ++k) {
+        storage[k].set_coords(5., 5., k < 2);
+        cells.push_back(&storage[k]);
+    }
+    fab->map_cells(cells);
+    bin* pads = fab->get_bin(5,5);
+    ASSERT_EQ(pads->supply(), 4.);
+
+    psi_params pps = {.a = 1.};
+    flow_state fs = {.iter = 0, .step = false, .h = pps, .psi_fn = psi_quadratic};
+    fab->run_flow(&fs);
+    ASSERT_EQ(fab->total_overflow(), 0.);
+    ASSERT_EQ(fab->get_cell_bin(&storage[0]), pads);
+    ASSERT_EQ(fab->get_cell_bin(&storage[1]), pads);
+    ASSERT_EQ(pads->cells.size(), 2);
+    delete fab;
+}
+
+// spreads that can't succeed end the flow with an error instead of
+// running forever
+TEST(Fabric, flow_gives_up) {
+    psi_params pps = {.a = 1.};
+    vector<string> nets = {"a"};
+
+    // a cell bigger than any bin
+    for (int threads : {1, 2}) {
+        fabric* fab = new fabric(10,10);
+        cell big(nets), other(nets);
+        big.set_area(2.);
+        big.set_coords(5.,5.);
+        other.set_coords(5.,5.);
+        fab->map_cells({&big, &other});
+        flow_state fs = {.iter = 0, .step = false, .h = pps, .psi_fn = psi_quadratic,
+                         .threads = threads};
+        fab->run_flow(&fs);
+        ASSERT_TRUE(fs.done_flow);
+        ASSERT_TRUE(fs.failed);
+        ASSERT_GT(fab->total_overflow(), 0.);
+        delete fab;
+    }
+
+    // enough room in total, but each bin of 1.5 only takes one unit cell
+    for (int threads : {1, 2}) {
+        fabric* fab = new fabric(2,1);
+        fab->set_capacity(0,0,2,1,1.5);
+        vector<cell> storage(3, cell(nets));
+        vector<cell*> cells;
+        for (auto& c : storage) {
+            c.set_coords(0.,0.);
+            cells.push_back(&c);
+        }
+        fab->map_cells(cells);
+        flow_state fs = {.iter = 0, .step = false, .h = pps, .psi_fn = psi_quadratic,
+                         .threads = threads};
+        fab->run_flow(&fs);
+        ASSERT_TRUE(fs.failed);
+        ASSERT_EQ(fab->total_overflow(), 0.5);
+        delete fab;
+    }
+}
+
+TEST(Fabric, cell_bin_map) {
+    fabric* fab = new fabric(10,10);
+    fab->mark_obstruction(3,3,3,3);
+
+    vector<string> nets = {"a","b"}; // irrelevant
+    cell c0(nets);
+    cell c1(nets);
+    cell c2(nets);
+    cell c3(nets);
+
+    c0.set_coords(0.1,0.1);
+    c1.set_coords(0.2,0.2);
+    c2.set_coords(0.3,1.1);
+    c3.set_coords(3.1,2.9);     // obstructed, goes to a neighbour
+
+    vector<cell*> cells = {&c0,&c1,&c2};
+    fab->map_cells(cells);
+    fab->map_cells({&c3});
+
+    bin* b00 = fab->get_bin(0,0);
+    bin* b01 = fab->get_bin(0,1);
+    bin* b02 = fab->get_bin(0,2);
+    ASSERT_EQ(fab->get_cell_bin(&c0), b00);
+    ASSERT_EQ(fab->get_cell_bin(&c1), b00);
+    ASSERT_EQ(fab->get_cell_bin(&c2), b01);
+    bin* b3 = fab->get_cell_bin(&c3);
+    ASSERT_NE(b3, nullptr);
+    ASSERT_TRUE(b3->usable);
+    ASSERT_EQ(b3->cells.front(), &c3);
+
+    queue<bin*> pk;
+    pk.push(b00);
+    pk.push(b01);
+    pk.push(b02);
+    fab->move_along_path(pk,99999.);
+
+    ASSERT_EQ(fab->get_cell_bin(&c0), b00);
+    ASSERT_EQ(fab->get_cell_bin(&c1), b01);
+    ASSERT_EQ(fab->get_cell_bin(&c2), b02);
+
+    cell unmapped(nets);
+    ASSERT_EQ(fab->get_cell_bin(&unmapped), nullptr);
+    delete fab;
+}
+
+TEST(Fabric, global_place_rounds) {
+    psi_params pps = {.a = 1.};
+    placer_params gp = {.max_iters = 4, .spread_weight = 1., .spread_ramp = 2.,
+                        .overlap_tol = 0., .hpwl_tol = 0.};
+
+    // tolerances that can't be met: every round runs
+    circuit* circ = new circuit("../data/cct1");
+    circ->set_solver(new pcg_solver());
+    circ->iter();
+    fabric* fab = new fabric(25,25);
+    fab->mark_obstruction(2,2,9,9);
+    flow_state fs = {.iter = 0, .step = false, .h = pps, .psi_fn = psi_quadratic};
+    ASSERT_EQ(global_place(circ, fab, &fs, &gp), 4);
+    ASSERT_EQ(fab->total_overflow(), 0.);
+
+    // the bins are the last solve's, flowed: spreading it again agrees
+    fabric* check = new fabric(25,25);
+    check->mark_obstruction(2,2,9,9);
+    check->map_cells(circ->get_cells());
+    fs = {.iter = 0, .step = false, .h = pps, .psi_fn = psi_quadratic};
+    check->run_flow(&fs);
+    for (auto* c : circ->get_cells()) {
+        bin* b = fab->get_cell_bin(c);
+        bin* e = check->get_cell_bin(c);
+        ASSERT_EQ(b->x, e->x);
+        ASSERT_EQ(b->y, e->y);
+    }
+    delete check;
+    delete fab;
+    delete circ;
+
+    // anything goes: stops after the first round can be compared
+    gp.overlap_tol = 1.;
+    gp.hpwl_tol = 1e9;
+    circ = new circuit("../data/cct1");
+    circ->set_solver(new pcg_solver());
+    circ->iter();
+    fab = new fabric(25,25);
+    fab->mark_obstruction(2,2,9,9);
+    fs = {.iter = 0, .step = false, .h = pps, .psi_fn = psi_quadratic};
+    ASSERT_EQ(global_place(circ, fab, &fs, &gp), 1);
+    ASSERT_EQ(fab->total_overflow(), 0.);
+
+    // every cell, pads included, is on the fabric
+    int mapped = 0;
+    for (auto* c : circ->get_cells()) {
+        if (fab->get_cell_bin(c) != nullptr)
+            ++mapped;
+    }
+    ASSERT_EQ(mapped, circ->get_n_cells());
+    delete fab;
+    delete circ;
+}
+
+// places a circuit with the pcg solver and maps it onto a fresh fabric
+static void map_circuit(string file, circuit** circ_out, fabric** fab_out) {
+    circuit* circ = new circuit(file);
+    circ->set_solver(new pcg_solver());
+    circ->iter();
+    fabric* fab = new fabric(25,25);
+    fab->mark_obstruction(2,2,9,9);
+    fab->map_cells(circ->get_cells());
+    *circ_out = circ;
+    *fab_out = fab;
+}
+
+// each cell's bin, in file order
+static vector<pair<double,double>> cell_bins(circuit* circ, fabric* fab) {
+    vector<pair<double,double>> result;
+    for (auto* c : circ->get_cells()) {
+        bin* b = fab->get_cell_bin(c);
+        result.push_back(make_pair(b->x, b->y));
+    }
+    return result;
+}
+
+TEST(Fabric, concurrent_flows_match_sequential) {
+    psi_params pps = {.a = 1.};
+    string files[2] = {"../data/cct2", "../data/cct3"};
+    vector<pair<double,double>> sequential[2], concurrent[2];
+    circuit* circs[2];
+    fabric* fabs[2];
+    flow_state fs[2];
+
+    for (int k = 0; k < 2; ++k) {
+        map_circuit(files[k], &circs[k], &fabs[k]);
+        fs[k] = {.iter = 0, .step = false, .h = pps, .psi_fn = psi_quadratic};
+        fabs[k]->run_flow(&fs[k]);
+        sequential[k] = cell_bins(circs[k], fabs[k]);
+        delete fabs[k];
+        delete circs[k];
+    }
+
+    for (int k = 0; k < 2; ++k) {
+        map_circuit(files[k], &circs[k], &fabs[k]);
+        fs[k] = {.iter = 0, .step = false, .h = pps, .psi_fn = psi_quadratic};
+    }
+    thread t0(&fabric::run_flow, fabs[0], &fs[0]);
+    thread t1(&fabric::run_flow, fabs[1], &fs[1]);
+    t0.join();
+    t1.join();
+
+    for (int k = 0; k < 2; ++k) {
+        concurrent[k] = cell_bins(circs[k], fabs[k]);
+        ASSERT_EQ(concurrent[k], sequential[k]);
+        ASSERT_EQ(fabs[k]->total_overflow(), 0.);
+        delete fabs[k];
+        delete circs[k];
+    }
+}
+
+// brute force scan of the grid, to check the overflow set against
+static vector<pair<double,int>> scan_overused(fabric* fab, int w, int h, double* total) {
+    vector<pair<double,int>> result;
+    *total = 0;
+    for (int i = 0; i < w; ++i) {
+        for (int j = 0; j < h; ++j) {
+            bin* b = fab->get_bin(i,j);
+            if (b->supply() > 0) {
+                result.push_back(make_pair(b->supply(), b->id));
+                *total += b->supply();
+            }
+        }
+    }
+    sort(result.begin(), result.end());
+    return result;
+}
+
+TEST(Fabric, overflow_set_tracks_moves) {
+    psi_params pps = {.a = 1.};
+    circuit* circ;
+    fabric* fab;
+    map_circuit("../data/cct2", &circ, &fab);
+    flow_state fs = {.iter = 0, .step = false, .h = pps, .psi_fn = psi_quadratic};
+
+    bool done = false;
+    while (!done) {
+        double total;
+        vector<pair<double,int>> expected = scan_overused(fab, 25, 25, &total);
+        vector<pair<double,int>> got;
+        for (auto* b : fab->get_overused_bins())
+            got.push_back(make_pair(b->supply(), b->id));
+        ASSERT_EQ(got, expected);
+        ASSERT_EQ(fab->total_overflow(), total);
+        done = fab->run_flow_step(&fs);
+    }
+    ASSERT_EQ(fab->total_overflow(), 0.);
+
+    fab->clear_cells();
+    ASSERT_TRUE(fab->get_overused_bins().empty());
+    delete fab;
+    delete circ;
+}
+
+TEST(Fabric, candidate_paths_spans) {
+    fabric* fab = new fabric(10,10);
+    fab->mark_obstruction(4,3,4,6);
+
+    vector<string> nets = {"a"};
+    vector<cell> storage(12, cell(nets));
+    vector<cell*> cells;
+    for (int k = 0; k < 12; ++k) {
+        // four in (3,4), the rest filling its neighbours
+        int x = k < 4 ? 3 : 2 + (k % 3);
+        int y = k < 4 ? 4 : 3 + (k % 2)*2;
+        storage[k].set_coords(x, y);
+        cells.push_back(&storage[k]);
+    }
+    fab->map_cells(cells);
+    bin* bi = fab->get_bin(3,4);
+
+    path_set P = fab->find_candidate_paths(bi, 1e9);
+    ASSERT_GE(P.size(), bi->supply());
+    for (int k = 0; k < P.size(); ++k) {
+        bin** p = P.begin(k);
+        ASSERT_EQ(p[0], bi);
+        ASSERT_TRUE(p[P.length(k)-1]->cells.empty());
+        for (int i = 1; i < P.length(k); ++i) {
+            ASSERT_TRUE(p[i]->usable);
+            ASSERT_EQ(fabs(p[i]->x - p[i-1]->x) + fabs(p[i]->y - p[i-1]->y), 1.);
+        }
+    }
+    delete fab;
+}
+
+// 200x200 fabric with a 60x60 block of bins holding three cells each, so
+// searches from the middle of the block have to go a long way out
+TEST(Fabric, candidate_paths_congested_bench) {
+    const int n = 200, block = 60, per_bin = 3;
+    fabric* fab = new fabric(n,n);
+    vector<string> nets = {"a"};
+    vector<cell> storage(block*block*per_bin, cell(nets));
+    vector<cell*> cells;
+    int k = 0;
+    for (int i = 0; i < block; ++i) {
+        for (int j = 0; j < block; ++j) {
+            for (int c = 0; c < per_bin; ++c) {
+                storage[k].set_coords(70 + i, 70 + j);
+                cells.push_back(&storage[k++]);
+            }
+        }
+    }
+    fab->map_cells(cells);
+    vector<bin*> overused = fab->get_overused_bins();
+    ASSERT_EQ(overused.size(), block*block);
+
+    size_t n_paths = 0;
+    auto t0 = chrono::steady_clock::now();
+    for (size_t b = 0; b < overused.size(); b += 4) {
+        n_paths += fab->find_candidate_paths(overused[b], 1e9).size();
+    }
+    auto t1 = chrono::steady_clock::now();
+    spdlog::info("find_candidate_paths on {} congested bins of {}x{}: {} ms, {} paths",
+        overused.size()/4, n, n, chrono::duration<double,milli>(t1-t0).count(), n_paths);
+    ASSERT_GE(n_paths, (overused.size()/4) * (per_bin-1));
+    delete fab;
+}
+
+TEST(Fabric, parallel_flow_matches_sequential) {
+    psi_params pps = {.a = 1.};
+    string files[2] = {"../data/cct2", "../data/cct3"};
+
+    for (auto& file : files) {
+        circuit* circ;
+        fabric* fab;
+        map_circuit(file, &circ, &fab);
+        flow_state fs = {.iter = 0, .step = false, .h = pps, .psi_fn = psi_quadratic};
+        fab->run_flow(&fs);
+        vector<pair<double,double>> sequential = cell_bins(circ, fab);
+        delete fab;
+
+        for (int threads : {1, 2, 4}) {
+            fab = new fabric(25,25);
+            fab->mark_obstruction(2,2,9,9);
+            fab->map_cells(circ->get_cells());
+            fs = {.iter = 0, .step = false, .h = pps, .psi_fn = psi_quadratic,
+                  .threads = threads};
+            fab->run_flow_parallel(&fs);
+            ASSERT_EQ(cell_bins(circ, fab), sequential) << file << ", " << threads << " threads";
+            ASSERT_EQ(fab->total_overflow(), 0.);
+            ASSERT_TRUE(fs.done_flow);
+            delete fab;
+        }
+        delete circ;
+    }
+}
+
+TEST(Fabric, detailed_place) {
+    psi_params pps = {.a = 1.};
+    placer_params gp = {.max_iters = 1, .spread_weight = 1., .spread_ramp = 2.,
+                        .overlap_tol = 0.05, .hpwl_tol = 0.01};
+    string files[2] = {"../data/cct2", "../data/cct3"};
+
+    for (auto& file : files) {
+        circuit* circ = new circuit(file);
+        circ->set_solver(new pcg_solver());
+        circ->iter();
+        fabric* fab = new fabric(25,25);
+        fab->mark_obstruction(2,2,9,9);
+        flow_state fs = {.iter = 0, .step = false, .h = pps, .psi_fn = psi_quadratic};
+        global_place(circ, fab, &fs, &gp);
+        double overflow = fab->total_overflow();
+
+        legalize(circ, fab);
+        double snapped = circ->hpwl();
+
+        detail_params dp = {.max_passes = 20, .radius = 1, .time_limit = 0.};
+        int kept = detailed_place(circ, fab, &dp);
+        ASSERT_GT(kept, 0);
+        ASSERT_LT(circ->hpwl(), snapped);
+        ASSERT_LE(fab->total_overflow(), overflow);
+
+        // cells sit on their bins, and the incremental hpwl matches a rebuild
+        double hpwl = circ->hpwl();
+        for (auto* c : circ->get_cells()) {
+            bin* b = fab->get_cell_bin(c);
+            ASSERT_NE(b, nullptr);
+            ASSERT_TRUE(b->usable);
+            if (!c->is_fixed()) {
+                ASSERT_EQ(c->get_coords(), make_pair(b->x, b->y));
+                c->set_coords(b->x, b->y);
+            }
+        }
+        ASSERT_NEAR(circ->hpwl(), hpwl, 1e-9);
+
+        // converged: another run keeps nothing
+        ASSERT_EQ(detailed_place(circ, fab, &dp), 0);
+        delete fab;
+        delete circ;
+    }
+}
+
+// without legalize() first, cells only leave their solved positions for
+// moves that are kept
+TEST(Fabric, detailed_place_unlegalized) {
+    circuit* circ;
+    fabric* fab;
+    map_circuit("../data/cct3", &circ, &fab);
+    flow_state fs = {.iter = 0, .step = false, .h = {.a = 1.}, .psi_fn = psi_quadratic};
+    fab->run_flow(&fs);
+
+    vector<pair<double,double>> coords;
+    vector<bin*> bins;
+    for (auto* c : circ->get_cells()) {
+        coords.push_back(c->get_coords());
+        bins.push_back(fab->get_cell_bin(c));
+    }
+    detail_params dp = {.max_passes = 1, .radius = 1, .time_limit = 0.};
+    detailed_place(circ, fab, &dp);
+    vector<cell*> cells = circ->get_cells();
+    for (size_t k = 0; k < cells.size(); ++k) {
+        if (fab->get_cell_bin(cells[k]) == bins[k]) {
+            ASSERT_EQ(cells[k]->get_coords(), coords[k]) << cells[k]->label;
+        }
+    }
+    delete fab;
+    delete circ;
+}
+
+TEST(Fabric, detailed_place_time_limit) {
+    circuit* circ;
+    fabric* fab;
+    map_circuit("../data/cct3", &circ, &fab);
+    flow_state fs = {.iter = 0, .step = false, .h = {.a = 1.}, .psi_fn = psi_quadratic};
+    fab->run_flow(&fs);
+    legalize(circ, fab);
+
+    detail_params dp = {.max_passes = 1000, .radius = 3, .time_limit = 1e-9};
+    auto t0 = chrono::steady_clock::now();
+    ASSERT_EQ(detailed_place(circ, fab, &dp), 0);
+    ASSERT_LT(chrono::duration<double>(chrono::steady_clock::now() - t0).count(), 1.);
+    delete fab;
+    delete circ;
+}
+
+TEST(Fabric, legalize) {
+    psi_params pps = {.a = 1.};
+    placer_params gp = {.max_iters = 2, .spread_weight = 1., .spread_ramp = 2.,
+                        .overlap_tol = 0.05, .hpwl_tol = 0.01};
+    string files[3] = {"../data/cct1", "../data/cct2", "../data/cct3"};
+
+    for (auto& file : files) {
+        circuit* circ = new circuit(file);
+        circ->set_solver(new pcg_solver());
+        circ->iter();
+        fabric* fab = new fabric(25,25);
+        fab->mark_obstruction(2,2,9,9);
+        flow_state fs = {.iter = 0, .step = false, .h = pps, .psi_fn = psi_quadratic};
+        global_place(circ, fab, &fs, &gp);
+        ASSERT_EQ(fab->total_overflow(), 0.);
+
+        legal_report r;
+        ASSERT_TRUE(legalize(circ, fab, &r));
+        ASSERT_EQ(r.overlap, 0.);
+        ASSERT_EQ(r.off_fabric, 0);
+        for (auto* c : circ->get_cells()) {
+            if (c->is_fixed())
+                continue;
+            bin* b = fab->get_cell_bin(c);
+            ASSERT_TRUE(b->usable);
+            ASSERT_EQ(c->get_coords(), make_pair(b->x, b->y));
+        }
+        delete fab;
+        delete circ;
+    }
+
+    // two cells forced into one unit bin of a flowed placement are caught
+    circuit* circ = new circuit("../data/cct1");
+    fabric* fab = new fabric(25,25);
+    fab->map_cells(circ->get_cells());
+    flow_state fs = {.iter = 0, .step = false, .h = pps, .psi_fn = psi_quadratic};
+    fab->run_flow(&fs);
+    vector<cell*> movable;
+    for (auto* c : circ->get_cells()) {
+        if (!c->is_fixed())
+            movable.push_back(c);
+    }
+    fab->move_cell_to_bin(movable[1], fab->get_cell_bin(movable[0]));
+    legal_report r;
+    ASSERT_FALSE(legalize(circ, fab, &r));
+    ASSERT_EQ(r.overlap, 1.);
+    ASSERT_EQ(r.overlapped_bins, 1);
+    ASSERT_EQ(r.off_fabric, 0);
+    delete fab;
+    delete circ;
+}
@@ -2,6 +2,8 @@
 #include <vector>
 #include <unordered_set>
 #include <utility>
+#include <fstream>
+#include <cstdio>
 #include "circuit.h"
 
 // Basic file read sanity checks
@@ -38,3 +40,150 @@ TEST(FileRead, cct1_check_cell_nets) {
     delete c;
 }
 
+
+TEST(FileRead, synthetic_streaming_parse) {
+    // wide labels, tabs and CRLF line endings
+    const int ncells = 20000;
+    string file = "synthetic_parse_cct";
+    ofstream out(file);
+    for (int c = 1; c <= ncells; ++c) {
+        out << c << "\t" << 100000 + c << " " << 200000 + (c % 97) << " -1\r\n";
+    }
+    out << "-1\r\n";
+    out << "1 3 4\r\n" << ncells << " 0 25\r\n";
+    out << "-1\r\n";
+    out.close();
+
+    circuit* circ = new circuit(file);
+    ASSERT_EQ(circ->get_n_cells(), ncells);
+
+    cell* last = circ->get_cell(to_string(ncells));
+    unordered_set<string> expected = {to_string(100000 + ncells), to_string(200000 + (ncells % 97))};
+    ASSERT_EQ(last->get_net_labels(), expected);
+    ASSERT_TRUE(last->is_fixed());
+    ASSERT_EQ(get<1>(last->get_coords()), 25.);
+
+    cell* first = circ->get_cell("1");
+    ASSERT_TRUE(first->is_fixed());
+    ASSERT_EQ(get<0>(first->get_coords()), 3.);
+    ASSERT_EQ(get<1>(first->get_coords()), 4.);
+
+    // every 97th cell shares net 200000
+    ASSERT_EQ(circ->get_net("200000")->num_pins(), ncells/97);
+    ASSERT_EQ(circ->get_netlist()->n_nets(), ncells + 97);
+
+    delete circ;
+    remove(file.c_str());
+}
+
+// the optional third section gives cell areas; cells left out are unit sized
+TEST(FileRead, cell_areas) {
+    string file = "areas_test";
+    ofstream out(file);
+    out << "1 10 11 -1\n2 10 -1\n3 11 -1\n4 10 11 -1\n-1\n"
+        << "1 0 0 -1\n4 5 5\n-1\n"
+        << "2 0.5\n3 2.25 -1\n-1\n";
+    out.close();
+
+    circuit* circ = new circuit(file);
+    ASSERT_EQ(circ->get_n_cells(), 4);
+    ASSERT_TRUE(circ->get_cell("1")->is_fixed());
+    ASSERT_TRUE(circ->get_cell("4")->is_fixed());
+    ASSERT_EQ(circ->get_cell("4")->get_coords(), make_pair(5., 5.));
+    ASSERT_EQ(circ->get_cell("1")->get_area(), 1.);
+    ASSERT_EQ(circ->get_cell("2")->get_area(), 0.5);
+    ASSERT_EQ(circ->get_cell("3")->get_area(), 2.25);
+
+    // areas survive compiling
+    string bin_file = "areas_test.bin";
+    ASSERT_TRUE(circ->write_binary(bin_file));
+    circuit* bin = new circuit(bin_file);
+    ASSERT_EQ(bin->get_cell("2")->get_area(), 0.5);
+    ASSERT_EQ(bin->get_cell("3")->get_area(), 2.25);
+    ASSERT_EQ(bin->get_cell("4")->get_area(), 1.);
+
+    delete circ;
+    delete bin;
+    remove(file.c_str());
+    remove(bin_file.c_str());
+}
+
+// fixed cell lines ending in -1 don't end the section early
+TEST(FileRead, fixed_lines_with_terminator) {
+    circuit* c = new circuit("../data/cct_square");
+    int n_fixed = 0;
+    for (auto* cl : c->get_cells()) {
+        if (cl->is_fixed())
+            ++n_fixed;
+    }
+    ASSERT_EQ(n_fixed, 4);
+    ASSERT_EQ(c->get_cell("0")->get_coords(), make_pair(0., 0.));
+    ASSERT_EQ(c->get_cell("1")->get_coords(), make_pair(0., 4.));
+    ASSERT_EQ(c->get_cell("2")->get_coords(), make_pair(4., 4.));
+    ASSERT_EQ(c->get_cell("3")->get_coords(), make_pair(4., 0.));
+    ASSERT_FALSE(c->get_cell("4")->is_fixed());
+    delete c;
+}
+
+TEST(FileRead, cct3_binary_round_trip) {
+    circuit* text = new circuit("../data/cct3");
+    string file = "cct3_round_trip.bin";
+    ASSERT_TRUE(text->write_binary(file));
+    circuit* bin = new circuit(file);
+
+    netlist* a = text->get_netlist();
+    netlist* b = bin->get_netlist();
+    ASSERT_EQ(bin->get_n_cells(), text->get_n_cells());
+    ASSERT_EQ(a->cell_labels, b->cell_labels);
+    ASSERT_EQ(a->net_labels, b->net_labels);
+    ASSERT_EQ(a->cell_ptr, b->cell_ptr);
+    ASSERT_EQ(a->cell_nets, b->cell_nets);
+    ASSERT_EQ(a->net_ptr, b->net_ptr);
+    ASSERT_EQ(a->net_cells, b->net_cells);
+
+    for (auto* c : text->get_cells()) {
+        cell* other = bin->get_cell(c->label);
+        ASSERT_NE(other, nullptr);
+        ASSERT_EQ(c->is_fixed(), other->is_fixed());
+        ASSERT_EQ(c->get_coords(), other->get_coords());
+        ASSERT_EQ(c->get_net_labels(), other->get_net_labels());
+    }
+    ASSERT_EQ(bin->get_net("12")->get_cell_labels(), text->get_net("12")->get_cell_labels());
+
+    delete text;
+    delete bin;
+    remove(file.c_str());
+}
+
+TEST(FileRead, binary_checksum_mismatch) {
+    // cct1 has 26 cells; the payload starts with xs, ys and areas, then
+    // the cell -> nets pin arrays (cell_ptr, then cell_nets)
+    const size_t coords = 3*sizeof(double)*26;
+    struct {
+        const char* what;
+        size_t offset;
+    } corruptions[] = {
+        {"areas[1]", 2*sizeof(double)*26 + 8},
+        {"cell_nets[1]", coords + sizeof(int32_t)*27 + 4},
+    };
+
+    for (auto& k : corruptions) {
+        circuit* text = new circuit("../data/cct1");
+        string file = "cct1_corrupt.bin";
+        ASSERT_TRUE(text->write_binary(file));
+        delete text;
+
+        // flip a byte of the payload
+        fstream f(file, ios::in | ios::out | ios::binary);
+        f.seekg(sizeof(netlist_file_header) + k.offset);
+        char byte = f.get();
+        f.seekp(sizeof(netlist_file_header) + k.offset);
+        f.put(byte ^ 0x1);
+        f.close();
+
+        circuit* bin = new circuit(file);
+        ASSERT_EQ(bin->get_n_cells(), 0) << k.what;
+        delete bin;
+        remove(file.c_str());
+    }
+}
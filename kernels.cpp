@@ -0,0 +1,189 @@
+#include "kernels.h"
+#include <math.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define KERNELS_AVX2
+#include <immintrin.h>
+#endif
+
+/****
+*
+* scalar versions
+*
+****/
+
+static void gather_box_scalar(const double* v, const int* idx, int n, double* lo, double* hi, int* n_lo, int* n_hi) {
+    double l = INFINITY, h = -INFINITY;
+    for (int k = 0; k < n; ++k) {
+        double x = v[idx[k]];
+        if (x < l)
+            l = x;
+        if (x > h)
+            h = x;
+    }
+    int cl = 0, ch = 0;
+    for (int k = 0; k < n; ++k) {
+        double x = v[idx[k]];
+        cl += (x == l);
+        ch += (x == h);
+    }
+    *lo = l;
+    *hi = h;
+    *n_lo = cl;
+    *n_hi = ch;
+}
+
+static double gather_round_abs_diff_scalar(const double* v, const int* idx, const double* t, int n) {
+    double result = 0.;
+    for (int k = 0; k < n; ++k)
+        result += fabs(round(v[idx[k]]) - t[k]);
+    return result;
+}
+
+/****
+*
+* AVX2 versions
+*
+****/
+
+#ifdef KERNELS_AVX2
+__attribute__((target("avx2")))
+static double hmin(__m256d a) {
+    __m128d m = _mm_min_pd(_mm256_castpd256_pd128(a), _mm256_extractf128_pd(a, 1));
+    return _mm_cvtsd_f64(_mm_min_sd(m, _mm_unpackhi_pd(m, m)));
+}
+
+__attribute__((target("avx2")))
+static double hmax(__m256d a) {
+    __m128d m = _mm_max_pd(_mm256_castpd256_pd128(a), _mm256_extractf128_pd(a, 1));
+    return _mm_cvtsd_f64(_mm_max_sd(m, _mm_unpackhi_pd(m, m)));
+}
+
+__attribute__((target("avx2")))
+static double hsum(__m256d a) {
+    __m128d s = _mm_add_pd(_mm256_castpd256_pd128(a), _mm256_extractf128_pd(a, 1));
+    return _mm_cvtsd_f64(_mm_add_sd(s, _mm_unpackhi_pd(s, s)));
+}
+
+__attribute__((target("avx2")))
+static long long hsum_epi64(__m256i a) {
+    long long t[4];
+    _mm256_storeu_si256((__m256i*)t, a);
+    return t[0] + t[1] + t[2] + t[3];
+}
+
+// two passes, min/max then the edge counts, four pins at a time
+__attribute__((target("avx2")))
+static void gather_box_avx2(const double* v, const int* idx, int n, double* lo, double* hi, int* n_lo, int* n_hi) {
+    if (n < 8) {
+        gather_box_scalar(v, idx, n, lo, hi, n_lo, n_hi);
+        return;
+    }
+    __m256d vl = _mm256_set1_pd(INFINITY);
+    __m256d vh = _mm256_set1_pd(-INFINITY);
+    int k = 0;
+    for (; k + 4 <= n; k += 4) {
+        __m256d x = _mm256_i32gather_pd(v, _mm_loadu_si128((const __m128i*)(idx + k)), 8);
+        // NaN lanes give back the second operand, so they are skipped like
+        // in the scalar compares
+        vl = _mm256_min_pd(x, vl);
+        vh = _mm256_max_pd(x, vh);
+    }
+    double l = hmin(vl), h = hmax(vh);
+    for (int j = k; j < n; ++j) {
+        double x = v[idx[j]];
+        if (x < l)
+            l = x;
+        if (x > h)
+            h = x;
+    }
+
+    // equal lanes compare to all ones, -1 as an integer
+    __m256d bl = _mm256_set1_pd(l);
+    __m256d bh = _mm256_set1_pd(h);
+    __m256i cl = _mm256_setzero_si256();
+    __m256i ch = _mm256_setzero_si256();
+    for (k = 0; k + 4 <= n; k += 4) {
+        __m256d x = _mm256_i32gather_pd(v, _mm_loadu_si128((const __m128i*)(idx + k)), 8);
+        cl = _mm256_sub_epi64(cl, _mm256_castpd_si256(_mm256_cmp_pd(x, bl, _CMP_EQ_OQ)));
+        ch = _mm256_sub_epi64(ch, _mm256_castpd_si256(_mm256_cmp_pd(x, bh, _CMP_EQ_OQ)));
+    }
+    int nl = hsum_epi64(cl), nh = hsum_epi64(ch);
+    for (; k < n; ++k) {
+        double x = v[idx[k]];
+        nl += (x == l);
+        nh += (x == h);
+    }
+    *lo = l;
+    *hi = h;
+    *n_lo = nl;
+    *n_hi = nh;
+}
+
+// round half away from zero: truncate, then step away from zero when the
+// dropped fraction is at least a half. x - trunc(x) is exact, so this
+// matches round() bit for bit
+__attribute__((target("avx2")))
+static double gather_round_abs_diff_avx2(const double* v, const int* idx, const double* t, int n) {
+    const __m256d sign = _mm256_set1_pd(-0.);
+    const __m256d half = _mm256_set1_pd(0.5);
+    const __m256d one = _mm256_set1_pd(1.);
+    __m256d acc = _mm256_setzero_pd();
+    int k = 0;
+    for (; k + 4 <= n; k += 4) {
+        __m256d x = _mm256_i32gather_pd(v, _mm_loadu_si128((const __m128i*)(idx + k)), 8);
+        __m256d tr = _mm256_round_pd(x, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+        __m256d frac = _mm256_andnot_pd(sign, _mm256_sub_pd(x, tr));
+        __m256d step = _mm256_or_pd(_mm256_and_pd(x, sign), one);
+        __m256d r = _mm256_add_pd(tr, _mm256_and_pd(_mm256_cmp_pd(frac, half, _CMP_GE_OQ), step));
+        __m256d d = _mm256_sub_pd(r, _mm256_loadu_pd(t + k));
+        acc = _mm256_add_pd(acc, _mm256_andnot_pd(sign, d));
+    }
+    return hsum(acc) + gather_round_abs_diff_scalar(v, idx + k, t + k, n - k);
+}
+
+// use_simd is set from a static initializer, which may run before the
+// runtime has filled in the cpu model, so it's initialized here first
+static bool cpu_has_avx2() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+#else
+static bool cpu_has_avx2() {
+    return false;
+}
+#endif
+
+/****
+*
+* dispatch
+*
+****/
+
+static bool use_simd = cpu_has_avx2();
+
+bool kernels_simd() {
+    return use_simd;
+}
+
+void set_kernels_simd(bool on) {
+    use_simd = on && cpu_has_avx2();
+}
+
+void gather_box(const double* v, const int* idx, int n, double* lo, double* hi, int* n_lo, int* n_hi) {
+#ifdef KERNELS_AVX2
+    if (use_simd) {
+        gather_box_avx2(v, idx, n, lo, hi, n_lo, n_hi);
+        return;
+    }
+#endif
+    gather_box_scalar(v, idx, n, lo, hi, n_lo, n_hi);
+}
+
+double gather_round_abs_diff(const double* v, const int* idx, const double* t, int n) {
+#ifdef KERNELS_AVX2
+    if (use_simd)
+        return gather_round_abs_diff_avx2(v, idx, t, n);
+#endif
+    return gather_round_abs_diff_scalar(v, idx, t, n);
+}
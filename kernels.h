@@ -0,0 +1,18 @@
+#ifndef __KERNELS_H__
+#define __KERNELS_H__
+
+// reductions over the structure-of-arrays cell coordinates (netlist::xs,
+// netlist::ys), gathered through a list of cell ids. each has a scalar and
+// an AVX2 version, the AVX2 one is used when the cpu supports it
+
+// lo/hi of v[idx[0..n)] and how many of those values equal each
+void gather_box(const double* v, const int* idx, int n, double* lo, double* hi, int* n_lo, int* n_hi);
+
+// sum of |round(v[idx[i]]) - t[i]|, round() as in <math.h>
+double gather_round_abs_diff(const double* v, const int* idx, const double* t, int n);
+
+bool kernels_simd();
+// turning simd on is ignored without AVX2, for benchmarks and tests
+void set_kernels_simd(bool on);
+
+#endif
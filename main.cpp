@@ -2,6 +2,7 @@
 #include <fstream>
 #include <string>
 #include <list>
+#include <cstdio>
 #include <getopt.h>
 #include "spdlog/spdlog.h"
 #include "version.h"
@@ -10,6 +11,8 @@
 #include "fabric.h"
 #include "umfpack.h"
 #include "psis.h"
+#include "solver.h"
+#include "placer.h"
 #include <thread>
 
 using namespace std;
@@ -33,11 +36,57 @@ void test_suitesparse() {
     for (i = 0 ; i < n ; i++) printf ("x [%d] = %g\n", i, x [i]) ;
 }
 
+enum long_only_opts {
+    OPT_SOLVER = 256,
+    OPT_PCG_PRECOND,
+    OPT_PCG_TOL,
+    OPT_PCG_MAX_ITER,
+    OPT_SERIAL_AXES,
+    OPT_COMPILE_NETLIST,
+    OPT_GP_ITERS,
+    OPT_GP_RAMP,
+    OPT_GP_OVERLAP_TOL,
+    OPT_GP_HPWL_TOL,
+    OPT_FLOW_THREADS,
+    OPT_FABRIC,
+    OPT_FABRIC_SIZE,
+    OPT_OBSTRUCTION,
+    OPT_NET_MODEL,
+    OPT_STAR_FANOUT,
+    OPT_DP_PASSES,
+    OPT_DP_RADIUS,
+    OPT_DP_TIME
+};
+
+static struct option long_opts[] = {
+    {"solver", required_argument, 0, OPT_SOLVER},
+    {"pcg-precond", required_argument, 0, OPT_PCG_PRECOND},
+    {"pcg-tol", required_argument, 0, OPT_PCG_TOL},
+    {"pcg-max-iter", required_argument, 0, OPT_PCG_MAX_ITER},
+    {"serial-axes", no_argument, 0, OPT_SERIAL_AXES},
+    {"compile-netlist", required_argument, 0, OPT_COMPILE_NETLIST},
+    {"gp-iters", required_argument, 0, OPT_GP_ITERS},
+    {"gp-ramp", required_argument, 0, OPT_GP_RAMP},
+    {"gp-overlap-tol", required_argument, 0, OPT_GP_OVERLAP_TOL},
+    {"gp-hpwl-tol", required_argument, 0, OPT_GP_HPWL_TOL},
+    {"flow-threads", required_argument, 0, OPT_FLOW_THREADS},
+    {"fabric", required_argument, 0, OPT_FABRIC},
+    {"fabric-size", required_argument, 0, OPT_FABRIC_SIZE},
+    {"obstruction", required_argument, 0, OPT_OBSTRUCTION},
+    {"net-model", required_argument, 0, OPT_NET_MODEL},
+    {"star-fanout", required_argument, 0, OPT_STAR_FANOUT},
+    {"dp-passes", required_argument, 0, OPT_DP_PASSES},
+    {"dp-radius", required_argument, 0, OPT_DP_RADIUS},
+    {"dp-time", required_argument, 0, OPT_DP_TIME},
+    {0, 0, 0, 0}
+};
+
 void print_usage() {
-    cout << "Usage: ./a2 [-hdvis] [-z b] [-p <l|q|c>] [-w b] [-a A] -f filename" << endl;
+    cout << "Usage: ./a2 [-hdvis] [-z b] [-p <l|q|c>] [-w b] [-a A] [--solver=umfpack|pcg] -f filename" << endl;
+    cout << "       ./a2 --compile-netlist filename out.bin" << endl;
     cout << "\t-h: this help message" <<endl;
     cout << "\t-v: print version info" <<endl;
-    cout << "\t-f circuit_file: the circuit file (required)" <<endl;
+    cout << "\t-f circuit_file: the circuit file, text or compiled (required)" <<endl;
     cout << "\t-d: turn on debug log level" <<endl;
     cout << "\t-i: enable interactive (gui) mode" <<endl;
     cout << "\t-s: step through algorithm" <<endl;
@@ -45,6 +94,26 @@ void print_usage() {
     cout << "\t-p [l]inear,[q]uadratic,[c]ubic: psi cost function " <<endl;
     cout << "\t-z b: use weight b for post flow spread" <<endl;
     cout << "\t-a A: scale coefficient A for psi calc" <<endl;
+    cout << "\t--solver=umfpack|pcg: linear solver for the placement system (default umfpack)" <<endl;
+    cout << "\t--pcg-precond=jacobi|ichol: pcg preconditioner (default jacobi)" <<endl;
+    cout << "\t--pcg-tol=t: pcg relative residual tolerance (default 1e-8)" <<endl;
+    cout << "\t--pcg-max-iter=n: pcg iteration limit (default 1000)" <<endl;
+    cout << "\t--serial-axes: solve the x and y systems one after the other" <<endl;
+    cout << "\t--compile-netlist in out.bin: write a binary netlist for fast reloading with -f, then exit" <<endl;
+    cout << "\t--gp-iters=n: max solve/spread rounds of global placement (default 1)" <<endl;
+    cout << "\t--gp-ramp=r: spread weight multiplier per round (default 2)" <<endl;
+    cout << "\t--gp-overlap-tol=f: stop once overflowing area / movable cell area <= f (default 0.05)" <<endl;
+    cout << "\t--gp-hpwl-tol=f: ...and the relative hpwl change <= f (default 0.01)" <<endl;
+    cout << "\t--flow-threads=n: spread independent overflowed bins on n threads (default 1)" <<endl;
+    cout << "\t--fabric=spec_file: fabric size, capacities and obstructions (see data/fabric_25x25)" <<endl;
+    cout << "\t--fabric-size=WxH: fabric size without a spec file (default 25x25)" <<endl;
+    cout << "\t--obstruction=x0,y0,x1,y1: add an obstruction, may be repeated" <<endl;
+    cout << "\t  with no fabric options the fabric is 25x25 with an obstruction at 2,2,9,9" <<endl;
+    cout << "\t--net-model=clique|star|b2b: how nets are modelled in the placement system (default clique)" <<endl;
+    cout << "\t--star-fanout=n: clique model, use a star for nets of more than n pins (default 0, never)" <<endl;
+    cout << "\t--dp-passes=n: detailed placement passes of cell moves and swaps after spreading (default 0, off)" <<endl;
+    cout << "\t--dp-radius=r: detailed placement tries bins up to r away (default 1)" <<endl;
+    cout << "\t--dp-time=s: stop detailed placement after s seconds (default 0, no limit)" <<endl;
 }
 
 void print_version() {
@@ -72,11 +141,128 @@ int main(int n, char** args) {
     int spread_weight = 1.0;
     double A = 1.0;
     double (*psi_fn)(int, psi_params*) = psi_quadratic;
+    string solver_name = "umfpack";
+    pcg_precond precond = JACOBI;
+    double pcg_tol = 1e-8;
+    int pcg_max_iter = 1000;
+    bool serial_axes = false;
+    string compile_in = "";
+    int flow_threads = 1;
+    string fabric_file = "";
+    int fabric_w = 25, fabric_h = 25;
+    bool fabric_given = false;
+    vector<vector<int>> obstructions;
+    net_model model = CLIQUE;
+    int star_fanout = 0;
+    detail_params dp = {.max_passes = 0, .radius = 1, .time_limit = 0.};
+    placer_params gp = {.max_iters = 1, .spread_weight = 1., .spread_ramp = 2.,
+                        .overlap_tol = 0.05, .hpwl_tol = 0.01};
 
     for(;;)
     {
-        switch(getopt(n, args, "vhf:disw:p:iz:a:"))
+        switch(getopt_long(n, args, "vhf:disw:p:iz:a:", long_opts, NULL))
         {
+            case OPT_SOLVER:
+                solver_name = optarg;
+                if (solver_name != "umfpack" && solver_name != "pcg") {
+                    spdlog::error("Invalid solver: specify umfpack or pcg");
+                    print_usage();
+                    return 1;
+                }
+                continue;
+            case OPT_PCG_PRECOND:
+                if (string(optarg) == "jacobi") {
+                    precond = JACOBI;
+                } else if (string(optarg) == "ichol") {
+                    precond = ICHOL;
+                } else {
+                    spdlog::error("Invalid preconditioner: specify jacobi or ichol");
+                    print_usage();
+                    return 1;
+                }
+                continue;
+            case OPT_PCG_TOL:
+                pcg_tol = stod(optarg);
+                continue;
+            case OPT_PCG_MAX_ITER:
+                pcg_max_iter = stoi(optarg);
+                continue;
+            case OPT_SERIAL_AXES:
+                serial_axes = true;
+                continue;
+            case OPT_COMPILE_NETLIST:
+                compile_in = optarg;
+                continue;
+            case OPT_GP_ITERS:
+                gp.max_iters = stoi(optarg);
+                continue;
+            case OPT_GP_RAMP:
+                gp.spread_ramp = stod(optarg);
+                continue;
+            case OPT_GP_OVERLAP_TOL:
+                gp.overlap_tol = stod(optarg);
+                continue;
+            case OPT_GP_HPWL_TOL:
+                gp.hpwl_tol = stod(optarg);
+                continue;
+            case OPT_FLOW_THREADS:
+                flow_threads = stoi(optarg);
+                continue;
+            case OPT_FABRIC:
+                fabric_file = optarg;
+                fabric_given = true;
+                continue;
+            case OPT_FABRIC_SIZE:
+                if (sscanf(optarg, "%dx%d", &fabric_w, &fabric_h) != 2 || fabric_w <= 0 || fabric_h <= 0) {
+                    spdlog::error("Invalid fabric size: specify WxH");
+                    print_usage();
+                    return 1;
+                }
+                fabric_given = true;
+                continue;
+            case OPT_OBSTRUCTION: {
+                vector<int> o(4);
+                if (sscanf(optarg, "%d,%d,%d,%d", &o[0], &o[1], &o[2], &o[3]) != 4
+                        || o[0] < 0 || o[1] < 0 || o[0] > o[2] || o[1] > o[3]) {
+                    spdlog::error("Invalid obstruction: specify x0,y0,x1,y1 with 0 <= x0 <= x1 and 0 <= y0 <= y1");
+                    print_usage();
+                    return 1;
+                }
+                obstructions.push_back(o);
+                fabric_given = true;
+                continue;
+            }
+            case OPT_NET_MODEL:
+                if (string(optarg) == "clique") {
+                    model = CLIQUE;
+                } else if (string(optarg) == "star") {
+                    model = STAR;
+                } else if (string(optarg) == "b2b") {
+                    model = B2B;
+                } else {
+                    spdlog::error("Invalid net model: specify clique, star or b2b");
+                    print_usage();
+                    return 1;
+                }
+                continue;
+            case OPT_STAR_FANOUT: {
+                char junk;
+                if (sscanf(optarg, "%d%c", &star_fanout, &junk) != 1 || star_fanout < 0) {
+                    spdlog::error("Invalid star fanout: specify a pin count, 0 for never");
+                    print_usage();
+                    return 1;
+                }
+                continue;
+            }
+            case OPT_DP_PASSES:
+                dp.max_passes = stoi(optarg);
+                continue;
+            case OPT_DP_RADIUS:
+                dp.radius = stoi(optarg);
+                continue;
+            case OPT_DP_TIME:
+                dp.time_limit = stod(optarg);
+                continue;
             case 'a':
                 A = (double)stoi(optarg);
                 continue;
@@ -141,6 +327,18 @@ int main(int n, char** args) {
 
     print_version();
 
+    if (compile_in != "") {
+        if (optind >= n) {
+            spdlog::error("Error: --compile-netlist needs an output file");
+            print_usage();
+            return 1;
+        }
+        circuit* circ = new circuit(compile_in);
+        bool ok = circ->get_n_cells() > 0 && circ->write_binary(args[optind]);
+        delete(circ);
+        return ok ? 0 : 1;
+    }
+
     if (file == "") {
         spdlog::error("Error: must provide input file");
         print_usage();
@@ -158,32 +356,71 @@ int main(int n, char** args) {
     if (fixed_weight != 0) {
         circ->set_fixed_weight_bias(((double)fixed_weight)/10.0);
     }
+    if (serial_axes) {
+        circ->set_parallel_axes(false);
+    }
+    if (model != CLIQUE || star_fanout > 0) {
+        circ->set_net_model(model, star_fanout);
+    }
+    if (solver_name == "pcg") {
+        spdlog::info("using pcg solver, tolerance {}", pcg_tol);
+        circ->set_solver(new pcg_solver(precond, pcg_tol, pcg_max_iter));
+    }
     circ->iter();
 
-    fabric* fab = new fabric(25,25);
-    fab->mark_obstruction(2,2,9,9);
-    fab->map_cells(circ->get_cells());
+    fabric* fab;
+    if (fabric_file != "") {
+        fab = read_fabric_spec(fabric_file);
+        if (fab == nullptr) {
+            delete(circ);
+            return 1;
+        }
+    } else {
+        fab = new fabric(fabric_w, fabric_h);
+    }
+    if (!fabric_given) {
+        fab->mark_obstruction(2,2,9,9);
+    }
+    for (auto& o : obstructions) {
+        if (o[0] >= fab->get_width() || o[1] >= fab->get_height()) {
+            spdlog::error("Invalid obstruction {},{},{},{}: x0,y0 has to be on the {}x{} fabric",
+                o[0], o[1], o[2], o[3], fab->get_width(), fab->get_height());
+            delete(circ);
+            delete(fab);
+            return 1;
+        }
+        fab->mark_obstruction(o[0], o[1], o[2], o[3]);
+    }
 
     //psi_params pps = {.a= 100., .b= 50., .c=25};
     psi_params pps = {.a= A};
-    flow_state fs = {.iter=0, .step = step, .h = pps, .psi_fn = psi_fn};
+    flow_state fs = {.iter=0, .step = step, .h = pps, .psi_fn = psi_fn, .threads = flow_threads};
 
     fab->spread_weight=(double)spread_weight;
+    gp.spread_weight = (double)spread_weight;
 
+    int status = 0;
     if (!fs.step) {
-        spdlog::debug("Running entire flow");
-        while(!fab->run_flow_step(&fs));
-    }
-
-    if (interactive) {
+        global_place(circ, fab, &fs, &gp);
+        // legalize logs what is wrong; detailed placement needs it legal
+        if (!legalize(circ, fab))
+            status = 1;
+        else if (dp.max_passes > 0)
+            detailed_place(circ, fab, &dp);
+        if (interactive) {
+            spdlog::info("Entering interactive mode");
+            ui_init(circ, fab, &fs);
+            ui_teardown();
+        }
+    } else {
+        // the flow is stepped from the ui
+        fab->map_cells(circ->get_cells());
         spdlog::info("Entering interactive mode");
         ui_init(circ, fab, &fs);
         ui_teardown();
-    }
 
-    spdlog::info("performing post flow spread");
-    circ->iter(fab);
-    if (interactive) {
+        spdlog::info("performing post flow spread");
+        circ->iter(fab);
         ui_init(circ, fab, &fs);
         ui_teardown();
     }
@@ -191,5 +428,5 @@ int main(int n, char** args) {
     spdlog::info("Exiting");
     delete(circ);
     delete(fab);
-    return 0;
+    return status;
 }
@@ -2,7 +2,14 @@
 #include <vector>
 #include <unordered_set>
 #include <utility>
+#include <chrono>
+#include <fstream>
+#include <cstdio>
+#include <algorithm>
 #include "circuit.h"
+#include "fabric.h"
+#include "solver.h"
+#include "psis.h"
 
 TEST(Matrix, cct1_sum_all_weights) {
     circuit* c = new circuit("../data/cct1");
@@ -69,3 +76,381 @@ TEST(Matrix, cct_num_movable_elems) {
     ASSERT_EQ(Q->n, 3);
     delete circ;
 }
+
+// reference assembly: the original dense walk over every pair of cells
+static void dense_reference(circuit* circ, vector<int>& Ap, vector<int>& Ai, vector<double>& Ax) {
+    vector<cell*> cells = circ->get_cells();
+    Ap.clear(); Ai.clear(); Ax.clear();
+    for(auto* xc : cells) {
+        if (xc->is_fixed())
+            continue;
+        Ap.push_back(Ax.size());
+        int row = 0;
+        for(auto* yc : cells) {
+            if (yc->is_fixed())
+                continue;
+            if (xc == yc) {
+                Ax.push_back(circ->sum_all_connected_weights(xc));
+                Ai.push_back(row);
+            } else if (xc->is_connected_to(yc)) {
+                Ax.push_back(-1*circ->get_clique_weight(xc,yc));
+                Ai.push_back(row);
+            }
+            ++row;
+        }
+    }
+    Ap.push_back(Ax.size());
+}
+
+static void check_against_dense(circuit* circ) {
+    vector<int> Ap, Ai;
+    vector<double> Ax;
+
+    auto t0 = chrono::steady_clock::now();
+    dense_reference(circ, Ap, Ai, Ax);
+    auto t1 = chrono::steady_clock::now();
+    circ->build_solver_matrix();
+    auto t2 = chrono::steady_clock::now();
+
+    spdlog::info("{} cells: dense build {} ms, sparse build {} ms", circ->get_n_cells(),
+        chrono::duration<double,milli>(t1-t0).count(),
+        chrono::duration<double,milli>(t2-t1).count());
+
+    solver_matrix* Q = circ->get_solver_matrix();
+    ASSERT_EQ(Q->Ap, Ap);
+    ASSERT_EQ(Q->Ai, Ai);
+    ASSERT_EQ(Q->Ax.size(), Ax.size());
+    for(size_t k = 0; k < Ax.size(); ++k) {
+        ASSERT_NEAR(Q->Ax[k], Ax[k], 1e-9);
+    }
+}
+
+TEST(Matrix, cct3_sparse_matches_dense) {
+    circuit* circ = new circuit("../data/cct3");
+    check_against_dense(circ);
+    delete circ;
+}
+
+TEST(Matrix, synthetic_sparse_matches_dense) {
+    // random netlist, 2-6 pins per net, with a ring of fixed pads
+    const int ncells = 1200;
+    const int nnets = 1500;
+    const int npads = 40;
+    srand(1387);
+    vector<vector<int>> cell_nets(ncells+1);
+    for(int n = 1; n <= nnets; ++n) {
+        int pins = 2 + rand() % 5;
+        for(int p = 0; p < pins; ++p)
+            cell_nets[1 + rand() % ncells].push_back(n);
+    }
+
+    string file = "synthetic_matrix_cct";
+    ofstream out(file);
+    for(int c = 1; c <= ncells; ++c) {
+        out << c;
+        for(int n : cell_nets[c])
+            out << " " << n;
+        out << " -1" << endl;
+    }
+    out << "-1" << endl;
+    for(int c = 1; c <= npads; ++c)
+        out << c * (ncells/npads) << " " << (c % 2) * 25 << " " << c % 26 << endl;
+    out << "-1" << endl;
+    out.close();
+
+    circuit* circ = new circuit(file);
+    check_against_dense(circ);
+    delete circ;
+    remove(file.c_str());
+}
+
+TEST(Matrix, cct3_spread_anchors_from_cell_bin_map) {
+    circuit* circ = new circuit("../data/cct3");
+    circ->set_solver(new pcg_solver());
+    circ->iter();
+
+    fabric* fab = new fabric(25,25);
+    fab->mark_obstruction(2,2,9,9);
+    fab->map_cells(circ->get_cells());
+    fab->spread_weight = 2.;
+    psi_params pps = {.a = 1.};
+    flow_state fs = {.iter = 0, .step = false, .h = pps, .psi_fn = psi_quadratic};
+    while(!fab->run_flow_step(&fs));
+
+    // reference anchors by searching every bin for the cell, as before
+    vector<double> diag, cx, cy;
+    for (auto* c : circ->get_cells()) {
+        if (c->is_fixed())
+            continue;
+        double d = circ->sum_all_connected_weights(c);
+        double x = 0., y = 0.;
+        for (auto* fc : circ->get_connected_fixed_cells(c)) {
+            x += circ->get_clique_weight(c, fc) * get<0>(fc->get_coords());
+            y += circ->get_clique_weight(c, fc) * get<1>(fc->get_coords());
+        }
+        for (int i = 0; i <= 25; ++i) {
+            for (int j = 0; j <= 25; ++j) {
+                bin* b = fab->get_bin(i,j);
+                if (find(b->cells.begin(), b->cells.end(), c) != b->cells.end()) {
+                    d += fab->spread_weight;
+                    x += fab->spread_weight * b->x;
+                    y += fab->spread_weight * b->y;
+                }
+            }
+        }
+        diag.push_back(d);
+        cx.push_back(x);
+        cy.push_back(y);
+    }
+
+    circ->iter(fab);
+    solver_matrix* Q = circ->get_solver_matrix();
+    ASSERT_EQ(Q->n, diag.size());
+    for (int j = 0; j < Q->n; ++j) {
+        for (int p = Q->Ap[j]; p < Q->Ap[j+1]; ++p) {
+            if (Q->Ai[p] == j)
+                ASSERT_NEAR(Q->Ax[p], diag[j], 1e-9);
+        }
+        ASSERT_NEAR(Q->Cx[j], cx[j], 1e-9);
+        ASSERT_NEAR(Q->Cy[j], cy[j], 1e-9);
+    }
+    delete fab;
+    delete circ;
+}
+
+TEST(Matrix, cct3_anchor_update_matches_rebuild) {
+    circuit* circ = new circuit("../data/cct3");
+    circ->set_solver(new pcg_solver());
+    circ->iter();
+    solver_matrix* Q = circ->get_solver_matrix();
+
+    fabric* fab = new fabric(25,25);
+    fab->mark_obstruction(2,2,9,9);
+    fab->map_cells(circ->get_cells());
+    psi_params pps = {.a = 1.};
+    flow_state fs = {.iter = 0, .step = false, .h = pps, .psi_fn = psi_quadratic};
+    while(!fab->run_flow_step(&fs));
+
+    // only the anchors change, so the same matrix is updated in place
+    fab->spread_weight = 1.;
+    circ->iter(fab);
+    fab->spread_weight = 3.;
+    circ->iter(fab);
+    ASSERT_EQ(circ->get_solver_matrix(), Q);
+    vector<int> Ap = Q->Ap, Ai = Q->Ai;
+    vector<double> Ax = Q->Ax, Cx = Q->Cx, Cy = Q->Cy;
+
+    circ->invalidate_solver_matrix();
+    circ->iter(fab);
+    Q = circ->get_solver_matrix();
+    ASSERT_EQ(Q->Ap, Ap);
+    ASSERT_EQ(Q->Ai, Ai);
+    for (size_t k = 0; k < Ax.size(); ++k) {
+        ASSERT_NEAR(Q->Ax[k], Ax[k], 1e-12);
+    }
+    for (int i = 0; i < Q->n; ++i) {
+        ASSERT_NEAR(Q->Cx[i], Cx[i], 1e-12);
+        ASSERT_NEAR(Q->Cy[i], Cy[i], 1e-12);
+    }
+
+    // dropping the fabric removes the anchors again
+    circ->iter();
+    circ->invalidate_solver_matrix();
+    vector<double> no_anchor_Ax = circ->get_solver_matrix()->Ax;
+    circ->iter();
+    ASSERT_EQ(circ->get_solver_matrix()->Ax, no_anchor_Ax);
+
+    // moving a pad changes the fixed part of the RHS
+    vector<double> before = circ->get_solver_matrix()->Cx;
+    cell* pad = nullptr;
+    for (auto* c : circ->get_cells()) {
+        if (c->is_fixed() && !pad)
+            pad = c;
+    }
+    pad->set_coords(get<0>(pad->get_coords()) + 1., get<1>(pad->get_coords()), true);
+    circ->iter();
+    vector<double> moved = circ->get_solver_matrix()->Cx;
+    ASSERT_NE(moved, before);
+    circ->invalidate_solver_matrix();
+    circ->iter();
+    ASSERT_EQ(circ->get_solver_matrix()->Cx, moved);
+
+    delete fab;
+    delete circ;
+}
+
+static vector<pair<double,double>> movable_coords(circuit* circ) {
+    vector<pair<double,double>> v;
+    for (auto* c : circ->get_cells()) {
+        if (!c->is_fixed())
+            v.push_back(c->get_coords());
+    }
+    return v;
+}
+
+static double sum_net_hpwl(circuit* circ) {
+    netlist* nl = circ->get_netlist();
+    double total = 0.;
+    for (int n = 0; n < nl->n_nets(); ++n) {
+        double x0 = 1e30, x1 = -1e30, y0 = 1e30, y1 = -1e30;
+        for (const int* c = nl->net_cells_begin(n); c != nl->net_cells_end(n); ++c) {
+            pair<double,double> p = circ->get_cell(*c)->get_coords();
+            x0 = min(x0, p.first);
+            x1 = max(x1, p.first);
+            y0 = min(y0, p.second);
+            y1 = max(y1, p.second);
+        }
+        total += (x1 - x0) + (y1 - y0);
+    }
+    return total;
+}
+
+TEST(Matrix, cct3_star_matches_clique) {
+    circuit* clique = new circuit("../data/cct3");
+    clique->set_solver(new pcg_solver(JACOBI, 1e-12));
+    clique->iter();
+    solver_matrix* Qc = clique->get_solver_matrix();
+
+    circuit* star = new circuit("../data/cct3");
+    star->set_solver(new pcg_solver(JACOBI, 1e-12));
+    star->set_net_model(STAR);
+    star->iter();
+    solver_matrix* Qs = star->get_solver_matrix();
+
+    // one more row per net of three or more pins, fewer entries overall
+    int n_star = 0;
+    netlist* nl = star->get_netlist();
+    for (int n = 0; n < nl->n_nets(); ++n) {
+        if (nl->n_pins(n) >= 3)
+            ++n_star;
+    }
+    ASSERT_GT(n_star, 0);
+    ASSERT_EQ(Qs->n, Qc->n + n_star);
+    ASSERT_LT(Qs->Ax.size(), Qc->Ax.size());
+
+    // eliminating the stars gives back the clique system
+    auto a = movable_coords(clique);
+    auto b = movable_coords(star);
+    ASSERT_EQ(a.size(), b.size());
+    for (size_t i = 0; i < a.size(); ++i) {
+        ASSERT_NEAR(a[i].first, b[i].first, 1e-6);
+        ASSERT_NEAR(a[i].second, b[i].second, 1e-6);
+    }
+    delete clique;
+    delete star;
+
+    // and still does with a fixed weight bias
+    clique = new circuit("../data/cct3");
+    clique->set_solver(new pcg_solver(JACOBI, 1e-12));
+    clique->set_fixed_weight_bias(2);
+    clique->iter();
+    star = new circuit("../data/cct3");
+    star->set_solver(new pcg_solver(JACOBI, 1e-12));
+    star->set_fixed_weight_bias(2);
+    star->set_net_model(STAR);
+    star->iter();
+    a = movable_coords(clique);
+    b = movable_coords(star);
+    for (size_t i = 0; i < a.size(); ++i) {
+        ASSERT_NEAR(a[i].first, b[i].first, 1e-6);
+        ASSERT_NEAR(a[i].second, b[i].second, 1e-6);
+    }
+    delete clique;
+    delete star;
+}
+
+TEST(Matrix, cct3_star_fanout) {
+    circuit* circ = new circuit("../data/cct3");
+    circ->set_solver(new pcg_solver());
+    circ->iter();
+    int n_movable = circ->get_solver_matrix()->n;
+
+    netlist* nl = circ->get_netlist();
+    int n_big = 0;
+    for (int n = 0; n < nl->n_nets(); ++n) {
+        if (nl->n_pins(n) > 4)
+            ++n_big;
+    }
+    circ->set_net_model(CLIQUE, 4);
+    circ->iter();
+    ASSERT_EQ(circ->get_solver_matrix()->n, n_movable + n_big);
+
+    // and back to plain cliques
+    circ->set_net_model(CLIQUE);
+    circ->iter();
+    ASSERT_EQ(circ->get_solver_matrix()->n, n_movable);
+    delete circ;
+}
+
+// with some nets as stars, each cell's diagonal is its clique weights plus
+// its star edges, and what the row doesn't spend on other variables goes
+// to fixed pins
+TEST(Matrix, cct3_star_fanout_diagonal) {
+    circuit* circ = new circuit("../data/cct3");
+    circ->set_solver(new pcg_solver());
+    circ->set_fixed_weight_bias(2);
+    circ->set_net_model(CLIQUE, 4);
+    circ->iter();
+    solver_matrix* Q = circ->get_solver_matrix();
+    netlist* nl = circ->get_netlist();
+
+    int j = 0;
+    int checked_stars = 0;
+    for (auto* c : circ->get_cells()) {
+        if (c->is_fixed())
+            continue;
+        double star_part = 0.;
+        double fixed_part = 0.;
+        for (const int* n = nl->cell_nets_begin(c->id); n != nl->cell_nets_end(c->id); ++n) {
+            int p = nl->n_pins(*n);
+            double w = circ->get_net(*n)->get_weight();
+            int n_fixed = 0;
+            for (const int* o = nl->net_cells_begin(*n); o != nl->net_cells_end(*n); ++o) {
+                if (circ->get_cell(*o)->is_fixed())
+                    ++n_fixed;
+            }
+            if (p > 4) {
+                star_part += p*w + n_fixed*2.;
+                fixed_part += n_fixed*2.;
+                ++checked_stars;
+            } else {
+                fixed_part += n_fixed*(w + 2.);
+            }
+        }
+
+        double diag = 0., off = 0.;
+        for (int k = Q->Ap[j]; k < Q->Ap[j+1]; ++k) {
+            if (Q->Ai[k] == j)
+                diag = Q->Ax[k];
+            else
+                off -= Q->Ax[k];
+        }
+        ASSERT_NEAR(diag, circ->sum_all_connected_weights(c) + star_part, 1e-9) << c->label;
+        ASSERT_NEAR(diag - off, fixed_part, 1e-9) << c->label;
+        ++j;
+    }
+    ASSERT_GT(checked_stars, 0);
+    delete circ;
+}
+
+TEST(Matrix, cct3_b2b_reduces_hpwl) {
+    circuit* clique = new circuit("../data/cct3");
+    clique->set_solver(new pcg_solver(JACOBI, 1e-10));
+    clique->iter();
+    double clique_hpwl = sum_net_hpwl(clique);
+
+    circuit* circ = new circuit("../data/cct3");
+    circ->set_solver(new pcg_solver(JACOBI, 1e-10));
+    circ->set_net_model(B2B);
+    circ->iter();
+    ASSERT_NEAR(sum_net_hpwl(circ), clique_hpwl, 1e-6);
+    for (int i = 0; i < 5; ++i)
+        circ->iter();
+    double b2b_hpwl = sum_net_hpwl(circ);
+    for (auto& p : movable_coords(circ)) {
+        ASSERT_TRUE(isfinite(p.first) && isfinite(p.second));
+    }
+    ASSERT_LT(b2b_hpwl, clique_hpwl);
+    delete clique;
+    delete circ;
+}
@@ -2,7 +2,14 @@
 #include <vector>
 #include <unordered_set>
 #include <utility>
+#include <algorithm>
+#include <cstdlib>
+#include <chrono>
+#include <fstream>
+#include <cstdio>
 #include "circuit.h"
+#include "fabric.h"
+#include "kernels.h"
 
 TEST(Net, cct1_check_nets_in_common) {
     circuit* c = new circuit("../data/cct1");
@@ -51,3 +58,163 @@ TEST(Net, cct1_check_net_weights) {
     ASSERT_EQ(n4->get_weight(), 2./2.);
     delete(c);
 }
+
+TEST(Net, cct1_netlist_csr) {
+    circuit* c = new circuit("../data/cct1");
+    netlist* nl = c->get_netlist();
+
+    ASSERT_EQ(nl->n_cells(), 26);
+    ASSERT_EQ(nl->net_ptr.size(), nl->n_nets() + 1);
+    ASSERT_EQ(nl->cell_ptr.size(), nl->n_cells() + 1);
+    ASSERT_EQ(nl->net_cells.size(), nl->cell_nets.size());
+
+    // net 12 connects 3 4 8 13 18 23 24 1, by id in file order
+    net* n12 = c->get_net("12");
+    vector<string> labels;
+    for (const int* p = nl->net_cells_begin(n12->id); p != nl->net_cells_end(n12->id); ++p) {
+        labels.push_back(c->get_cell(*p)->label);
+    }
+    vector<string> expected = {"1","3","4","8","13","18","23","24"};
+    ASSERT_EQ(labels, expected);
+
+    // both directions hold the same pins
+    for (int cid = 0; cid < nl->n_cells(); ++cid) {
+        for (const int* n = nl->cell_nets_begin(cid); n != nl->cell_nets_end(cid); ++n) {
+            ASSERT_TRUE(binary_search(nl->net_cells_begin(*n), nl->net_cells_end(*n), cid));
+        }
+    }
+    delete(c);
+}
+
+static double brute_force_hpwl(circuit* c) {
+    netlist* nl = c->get_netlist();
+    double total = 0.;
+    for (int n = 0; n < nl->n_nets(); ++n) {
+        double x0 = 1e30, x1 = -1e30, y0 = 1e30, y1 = -1e30;
+        for (const int* i = nl->net_cells_begin(n); i != nl->net_cells_end(n); ++i) {
+            pair<double,double> p = c->get_cell(*i)->get_coords();
+            x0 = min(x0, p.first);
+            x1 = max(x1, p.first);
+            y0 = min(y0, p.second);
+            y1 = max(y1, p.second);
+        }
+        total += (x1 - x0) + (y1 - y0);
+    }
+    return total;
+}
+
+TEST(Net, cct_square_hpwl) {
+    circuit* c = new circuit("../data/cct_square");
+    // cells 0-3 sit on the corners of a 4x4 square, 4-6 at the origin
+    // net 0: 0,4 net 1: 1,4 net 5: 4,5 net 6: 4,6 net 7: 2,5,6 net 10: 3,6
+    ASSERT_DOUBLE_EQ(c->hpwl(), 0. + 4. + 0. + 0. + 8. + 4.);
+    ASSERT_DOUBLE_EQ(c->net_hpwl(c->get_net("7")->id), 8.);
+
+    // pulling cell 6 to the middle stretches net 6, 7 and 10 keep their size
+    double d = c->move_cell(c->get_cell("6"), 2., 2.);
+    ASSERT_DOUBLE_EQ(d, 4. + 0. + 0.);
+    ASSERT_DOUBLE_EQ(c->hpwl(), brute_force_hpwl(c));
+    delete c;
+}
+
+TEST(Net, cct3_incremental_hpwl) {
+    circuit* c = new circuit("../data/cct3");
+    vector<cell*> movable;
+    for (auto* cl : c->get_cells()) {
+        if (!cl->is_fixed())
+            movable.push_back(cl);
+    }
+    ASSERT_DOUBLE_EQ(c->hpwl(), brute_force_hpwl(c));
+
+    // integer positions on a small grid, so pins often tie on box edges
+    srand(1);
+    for (int k = 0; k < 5000; ++k) {
+        cell* cl = movable[rand() % movable.size()];
+        double before = c->hpwl();
+        double d = c->move_cell(cl, rand() % 6, rand() % 6);
+        ASSERT_NEAR(c->hpwl(), before + d, 1e-9);
+        if (k % 250 == 0)
+            ASSERT_NEAR(c->hpwl(), brute_force_hpwl(c), 1e-6);
+    }
+    ASSERT_NEAR(c->hpwl(), brute_force_hpwl(c), 1e-6);
+
+    // moving cells directly is picked up on the next query
+    movable[0]->set_coords(20., 20.);
+    ASSERT_NEAR(c->hpwl(), brute_force_hpwl(c), 1e-6);
+    delete c;
+}
+
+// random circuit of ncells cells on as many nets of 2-8 pins. the hpwl and
+// displacement kernels give the same results with and without simd
+static void check_kernels_synthetic(int ncells) {
+    const int nnets = ncells;
+    srand(1387);
+    vector<vector<int>> cell_nets(ncells+1);
+    long pins = 0;
+    for (int n = 1; n <= nnets; ++n) {
+        int p = 2 + rand() % 7;
+        for (int k = 0; k < p; ++k)
+            cell_nets[1 + rand() % ncells].push_back(n);
+        pins += p;
+    }
+    string file = "synthetic_kernels_cct";
+    ofstream out(file);
+    for (int c = 1; c <= ncells; ++c) {
+        out << c;
+        for (int n : cell_nets[c])
+            out << " " << n;
+        out << " -1" << endl;
+    }
+    out << "-1" << endl << "1 0 0" << endl << "-1" << endl;
+    out.close();
+
+    circuit* c = new circuit(file);
+    remove(file.c_str());
+    // quarter steps, so plenty of ties on box edges and halves to round
+    for (auto* cl : c->get_cells()) {
+        if (!cl->is_fixed())
+            cl->set_coords((rand() % 100) * 0.25, (rand() % 100) * 0.25);
+    }
+
+    bool simd = kernels_simd();
+    double result[2];
+    double ms[2];
+    for (int on = 0; on < 2; ++on) {
+        set_kernels_simd(on);
+        c->get_cell(1)->set_coords(0, 0, true);     // forces a full rebuild
+        auto t0 = chrono::steady_clock::now();
+        result[on] = c->hpwl();
+        ms[on] = chrono::duration<double,milli>(chrono::steady_clock::now() - t0).count();
+    }
+    spdlog::info("hpwl over {} pins: scalar {:.3f} ms, {} {:.3f} ms", pins, ms[0],
+        kernels_simd() ? "avx2" : "scalar", ms[1]);
+    ASSERT_EQ(result[0], result[1]);
+    ASSERT_DOUBLE_EQ(result[1], brute_force_hpwl(c));
+
+    fabric* fab = new fabric(25,25);
+    fab->map_cells(c->get_cells());
+    unsigned long long disp[2];
+    for (int on = 0; on < 2; ++on) {
+        set_kernels_simd(on);
+        auto t0 = chrono::steady_clock::now();
+        disp[on] = fab->calculate_total_displacement();
+        ms[on] = chrono::duration<double,milli>(chrono::steady_clock::now() - t0).count();
+    }
+    spdlog::info("displacement over {} cells: scalar {:.3f} ms, {} {:.3f} ms", ncells, ms[0],
+        kernels_simd() ? "avx2" : "scalar", ms[1]);
+    ASSERT_EQ(disp[0], disp[1]);
+
+    set_kernels_simd(simd);
+    delete fab;
+    delete c;
+}
+
+TEST(Net, synthetic_kernels_match) {
+    check_kernels_synthetic(2000);
+}
+
+// 200k cells, about a million pins. a benchmark, run it with
+// --gtest_also_run_disabled_tests
+TEST(Net, DISABLED_synthetic_1m_pin_kernels) {
+    check_kernels_synthetic(200000);
+}
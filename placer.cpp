@@ -0,0 +1,254 @@
+#include "placer.h"
+#include "circuit.h"
+#include "fabric.h"
+#include "kernels.h"
+#include "spdlog/spdlog.h"
+#include <math.h>
+#include <chrono>
+#include <algorithm>
+#include <unordered_map>
+
+using namespace std;
+
+static double ms_since(chrono::steady_clock::time_point t) {
+    return chrono::duration<double,milli>(chrono::steady_clock::now() - t).count();
+}
+
+// alternates flow spreading and anchored solves with a ramping spread
+// weight. expects the unanchored solve to have been done already. each
+// round maps the current solution onto the fabric and measures its
+// overlap, spreads it, then re-solves against the spread bins. it stops
+// early once the mapped solution barely overlaps and the hpwl has settled;
+// the fabric is always left holding a legal (flowed) bin assignment of the
+// last solution. returns the number of anchored solves done
+int global_place(circuit* circ, fabric* fab, flow_state* fs, placer_params* p) {
+    double movable_area = 0.;
+    for (auto* c : circ->get_cells()) {
+        if (!c->is_fixed())
+            movable_area += c->get_area();
+    }
+
+    double weight = p->spread_weight;
+    double hpwl = circ->hpwl();
+    double prev_hpwl = -1.;
+    int solves = 0;
+    auto t_start = chrono::steady_clock::now();
+
+    auto flow = [&]() {
+        fab->clear_cells();
+        fab->map_cells(circ->get_cells());
+        double overlap = fab->total_overflow();
+        fs->iter = 0;
+        fs->done_flow = false;
+        fab->run_flow(fs);
+        return overlap;
+    };
+
+    bool flowed = false;    // the bins hold the current solution
+    for (int k = 0; k < p->max_iters; ++k) {
+        auto t0 = chrono::steady_clock::now();
+        double overlap = flow();
+        double overlap_ratio = movable_area > 0. ? overlap / movable_area : 0.;
+        double flow_ms = ms_since(t0);
+        flowed = true;
+
+        bool converged = (prev_hpwl > 0.)
+            && (overlap_ratio <= p->overlap_tol)
+            && (fabs(hpwl - prev_hpwl) <= p->hpwl_tol * prev_hpwl);
+        if (converged) {
+            spdlog::info("gp iter {}: overlap {} ({:.2f}%), hpwl {}, flow {:.3f} ms: converged",
+                k, overlap, 100.*overlap_ratio, hpwl, flow_ms);
+            break;
+        }
+
+        auto t1 = chrono::steady_clock::now();
+        fab->spread_weight = weight;
+        circ->iter(fab);
+        ++solves;
+        flowed = false;
+        double solve_ms = ms_since(t1);
+
+        prev_hpwl = hpwl;
+        hpwl = circ->hpwl();
+        spdlog::info("gp iter {}: spread weight {}, overlap {} ({:.2f}%), hpwl {} -> {}, flow {:.3f} ms, solve {:.3f} ms",
+            k, weight, overlap, 100.*overlap_ratio, prev_hpwl, hpwl, flow_ms, solve_ms);
+        weight *= p->spread_ramp;
+    }
+
+    // out of rounds after a solve: spread it so the bins match the cells
+    if (!flowed && solves > 0) {
+        auto t0 = chrono::steady_clock::now();
+        double overlap = flow();
+        spdlog::info("gp final flow: overlap {}, hpwl {}, flow {:.3f} ms", overlap, hpwl, ms_since(t0));
+    }
+
+    spdlog::info("global placement: {} solves, {:.3f} ms", solves, ms_since(t_start));
+    return solves;
+}
+
+// writes each movable cell's bin coordinates back to the cell, so the
+// placement is legal and not just the bin assignment. reports the hpwl
+// before and after and the displacement from the solved positions, then
+// checks the result independently of the flow's bookkeeping: every cell's
+// area is added to the bin at its final coordinates (fixed cells stay
+// where they are) and each occupied bin is compared to its capacity, or
+// to its fixed cells' area if they already fill it (overlapping pads are
+// the input's doing).
+// linear in the number of cells. returns true when the placement is legal,
+// what is wrong with it otherwise goes in *r if given
+bool legalize(circuit* circ, fabric* fab, legal_report* r) {
+    auto t_start = chrono::steady_clock::now();
+    double hpwl_before = circ->hpwl();
+
+    vector<cell*> movable;
+    vector<int> ids;
+    vector<double> bx, by;
+    netlist* nl = circ->get_netlist();
+    for (auto* c : circ->get_cells()) {
+        bin* b = fab->get_cell_bin(c);
+        if (c->is_fixed() || b == nullptr)
+            continue;
+        movable.push_back(c);
+        ids.push_back(c->id);
+        bx.push_back(b->x);
+        by.push_back(b->y);
+    }
+    double displacement = gather_round_abs_diff(nl->xs.data(), ids.data(), bx.data(), ids.size())
+        + gather_round_abs_diff(nl->ys.data(), ids.data(), by.data(), ids.size());
+    for (size_t i = 0; i < movable.size(); ++i)
+        circ->move_cell(movable[i], bx[i], by[i]);
+
+    unordered_map<bin*, pair<double,double>> used;     // all, fixed
+    int off_fabric = 0;
+    for (auto* c : circ->get_cells()) {
+        pair<double,double> p = c->get_coords();
+        int x = (int)round(get<0>(p));
+        int y = (int)round(get<1>(p));
+        if (x < 0 || y < 0 || x > fab->get_width() || y > fab->get_height()) {
+            if (!c->is_fixed())
+                ++off_fabric;
+            continue;
+        }
+        pair<double,double>& u = used[fab->get_bin(x, y)];
+        u.first += c->get_area();
+        if (c->is_fixed())
+            u.second += c->get_area();
+    }
+    double overlap = 0.;
+    int overlapped_bins = 0;
+    for (auto& e : used) {
+        double cap = e.first->usable ? e.first->capacity : 0.;
+        double over = e.second.first - max(cap, e.second.second);
+        if (over > AREA_EPS) {
+            overlap += over;
+            ++overlapped_bins;
+        }
+    }
+
+    spdlog::info("legalization: hpwl {} -> {}, displacement {}, {} cells in {} bins, {:.3f} ms",
+        hpwl_before, circ->hpwl(), displacement, movable.size(), used.size(), ms_since(t_start));
+    if (overlap > 0. || off_fabric > 0)
+        spdlog::error("legalization left {} area of overlap in {} bins, {} cells off the fabric",
+            overlap, overlapped_bins, off_fabric);
+    if (r != nullptr)
+        *r = {.overlap = overlap, .overlapped_bins = overlapped_bins, .off_fabric = off_fabric};
+    return overlap == 0. && off_fabric == 0;
+}
+
+// a bin may take on a cell's area if it stays within its capacity, or at
+// least gets no fuller than it already is
+static bool fits(bin* b, double out, double in) {
+    double after = b->usage() - out + in;
+    return after <= max(b->capacity, b->usage()) + AREA_EPS;
+}
+
+// greedy improvement of a legalized placement, see legalize(). each pass
+// tries every movable cell
+// in every usable bin within p->radius: a plain move if the bin has room
+// for it, otherwise a swap with each movable cell there that fits both
+// ways. moves are made on the circuit's incremental hpwl and kept only if
+// it went down. stops after a pass with nothing kept, after p->max_passes
+// or when p->time_limit runs out. returns the number of moves and swaps kept
+int detailed_place(circuit* circ, fabric* fab, detail_params* p) {
+    auto t_start = chrono::steady_clock::now();
+    auto out_of_time = [&]() {
+        return p->time_limit > 0. && ms_since(t_start) > p->time_limit * 1000.;
+    };
+
+    vector<cell*> movable;
+    for (auto* c : circ->get_cells()) {
+        if (!c->is_fixed() && fab->get_cell_bin(c) != nullptr)
+            movable.push_back(c);
+    }
+    double hpwl_start = circ->hpwl();
+
+    // gains below this are rounding in the hpwl deltas
+    const double min_gain = 1e-9;
+    int kept = 0;
+    int passes = 0;
+    bool timed_out = false;
+    while (passes < p->max_passes && !timed_out) {
+        ++passes;
+        int kept_pass = 0;
+        for (auto* c : movable) {
+            if (out_of_time()) {
+                timed_out = true;
+                break;
+            }
+            bin* b = fab->get_cell_bin(c);
+            double area = c->get_area();
+            // rejected trials put cells back where they were, which is only
+            // their bin's position if the placement was legalized
+            pair<double,double> at = c->get_coords();
+            int x0 = max(0, (int)b->x - p->radius);
+            int x1 = min(fab->get_width() - 1, (int)b->x + p->radius);
+            int y0 = max(0, (int)b->y - p->radius);
+            int y1 = min(fab->get_height() - 1, (int)b->y + p->radius);
+            bool moved = false;
+            for (int x = x0; x <= x1 && !moved; ++x) {
+                for (int y = y0; y <= y1 && !moved; ++y) {
+                    bin* t = fab->get_bin(x, y);
+                    if (t == b || !t->usable)
+                        continue;
+
+                    if (fits(t, 0., area)) {
+                        if (circ->move_cell(c, t->x, t->y) < -min_gain) {
+                            fab->move_cell_to_bin(c, t);
+                            moved = true;
+                        } else {
+                            circ->move_cell(c, get<0>(at), get<1>(at));
+                        }
+                        continue;
+                    }
+
+                    for (size_t k = 0; k < t->cells.size() && !moved; ++k) {
+                        cell* d = t->cells[k];
+                        if (d->is_fixed() || !fits(t, d->get_area(), area) || !fits(b, area, d->get_area()))
+                            continue;
+                        pair<double,double> d_at = d->get_coords();
+                        double delta = circ->move_cell(c, t->x, t->y);
+                        delta += circ->move_cell(d, b->x, b->y);
+                        if (delta < -min_gain) {
+                            fab->move_cell_to_bin(c, t);
+                            fab->move_cell_to_bin(d, b);
+                            moved = true;
+                        } else {
+                            circ->move_cell(d, get<0>(d_at), get<1>(d_at));
+                            circ->move_cell(c, get<0>(at), get<1>(at));
+                        }
+                    }
+                }
+            }
+            if (moved)
+                ++kept_pass;
+        }
+        kept += kept_pass;
+        spdlog::debug("detail pass {}: {} moves kept, hpwl {}", passes, kept_pass, circ->hpwl());
+        if (kept_pass == 0)
+            break;
+    }
+
+    spdlog::info("detailed placement: hpwl {} -> {}, {} moves kept in {} passes, {:.3f} ms{}",
+        hpwl_start, circ->hpwl(), kept, passes, ms_since(t_start), timed_out ? " (time limit)" : "");
+    return kept;
+}
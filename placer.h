@@ -0,0 +1,31 @@
+#ifndef __PLACER_H__
+#define __PLACER_H__
+#include "circuit.h"
+#include "fabric.h"
+
+struct placer_params {
+    int max_iters;          // solve + spread rounds
+    double spread_weight;   // anchor weight of the first post-flow solve
+    double spread_ramp;     // anchor weight multiplier per round
+    double overlap_tol;     // converged when overflow/movable cell area is at most this...
+    double hpwl_tol;        // ...and the relative hpwl change is at most this
+};
+
+struct detail_params {
+    int max_passes;         // passes over every movable cell
+    int radius;             // cells try bins up to this many bins away on either axis
+    double time_limit;      // seconds, 0 for no limit
+};
+
+// what legalize found wrong with a placement
+struct legal_report {
+    double overlap;         // cell area over capacity, summed over bins
+    int overlapped_bins;
+    int off_fabric;         // movable cells outside the fabric
+};
+
+int global_place(circuit* circ, fabric* fab, flow_state* fs, placer_params* p);
+bool legalize(circuit* circ, fabric* fab, legal_report* r = nullptr);
+int detailed_place(circuit* circ, fabric* fab, detail_params* p);
+
+#endif
@@ -0,0 +1,272 @@
+#include "solver.h"
+#include "circuit.h"
+#include "spdlog/spdlog.h"
+#include <math.h>
+#include <vector>
+#include <algorithm>
+
+#ifndef GTEST
+#include "umfpack.h"
+#endif
+
+using namespace std;
+
+// y = Q x, Q stored as a full (both triangles) CSC matrix
+void solver_matrix_multiply(solver_matrix* Q, const double* x, double* y) {
+    for(int i = 0; i < Q->n; ++i)
+        y[i] = 0.;
+    for(int j = 0; j < Q->n; ++j) {
+        for(int p = Q->Ap[j]; p < Q->Ap[j+1]; ++p) {
+            y[Q->Ai[p]] += Q->Ax[p] * x[j];
+        }
+    }
+}
+
+static double dot(const vector<double>& a, const vector<double>& b) {
+    double result = 0.;
+    for(size_t i = 0; i < a.size(); ++i)
+        result += a[i]*b[i];
+    return result;
+}
+
+/****
+*
+* umfpack_solver class functions
+*
+****/
+
+umfpack_solver::umfpack_solver() {
+    Numeric = nullptr;
+}
+
+umfpack_solver::~umfpack_solver() {
+    free_factorization();
+}
+
+// the symbolic analysis only depends on the sparsity pattern, so it is
+// reused for as long as a rebuilt matrix has the same pattern (e.g. across
+// spreading iterations, where only the anchor weights on the diagonal
+// change, or for each axis of a settled B2B system)
+void* umfpack_solver::get_symbolic(solver_matrix* Q) {
+    for (size_t k = 0; k < symbolics.size(); ++k) {
+        if (symbolics[k].Ap == Q->Ap && symbolics[k].Ai == Q->Ai) {
+            spdlog::debug("reusing symbolic factorization");
+            rotate(symbolics.begin(), symbolics.begin() + k, symbolics.begin() + k + 1);
+            return symbolics[0].Symbolic;
+        }
+    }
+
+    umfpack_symbolic entry = {nullptr, Q->Ap, Q->Ai};
+    #ifndef GTEST
+    double *null = (double *) NULL ;
+    int rc = umfpack_di_symbolic (Q->n, Q->n, Q->get_Ap_ss(), Q->get_Ai_ss(), Q->get_Ax_ss(), &entry.Symbolic, null, null) ;
+    if (rc != UMFPACK_OK) {
+        spdlog::error("Error in umfpack_di_symbolic: {}", rc);
+    }
+    #endif
+
+    if ((int)symbolics.size() == max_symbolic) {
+        #ifndef GTEST
+        if (symbolics.back().Symbolic != nullptr)
+            umfpack_di_free_symbolic (&symbolics.back().Symbolic) ;
+        #endif
+        symbolics.pop_back();
+    }
+    symbolics.insert(symbolics.begin(), entry);
+    return symbolics[0].Symbolic;
+}
+
+// one factorization of Q serves both axes
+void umfpack_solver::factor(solver_matrix* Q) {
+    void* Symbolic = get_symbolic(Q);
+    #ifndef GTEST
+    int rc;
+    double *null = (double *) NULL ;
+
+    if (Numeric != nullptr) {
+        umfpack_di_free_numeric (&Numeric) ;
+        Numeric = nullptr;
+    }
+
+    rc = umfpack_di_numeric (Q->get_Ap_ss(), Q->get_Ai_ss(), Q->get_Ax_ss(), Symbolic, &Numeric, null, null) ;
+    if (rc != UMFPACK_OK) {
+        spdlog::error("Error in umfpack_di_numeric: {}", rc);
+    }
+    #else
+    (void)Symbolic;
+    #endif
+}
+
+void umfpack_solver::free_factorization() {
+    #ifndef GTEST
+    for (auto& e : symbolics) {
+        if (e.Symbolic != nullptr)
+            umfpack_di_free_symbolic (&e.Symbolic) ;
+    }
+    if (Numeric != nullptr)
+        umfpack_di_free_numeric (&Numeric) ;
+    #endif
+    symbolics.clear();
+    Numeric = nullptr;
+}
+
+void umfpack_solver::solve(solver_matrix* Q, enum axis ax, double* x) {
+    #ifndef GTEST
+    int rc;
+    double *null = (double *) NULL ;
+
+    rc = umfpack_di_solve (UMFPACK_A, Q->get_Ap_ss(), Q->get_Ai_ss(), Q->get_Ax_ss(), x, Q->get_C_ss(ax), Numeric, null, null) ;
+    if (rc != UMFPACK_OK) {
+        spdlog::error("Error in umfpack_di_solve: {}", rc);
+    }
+    #endif
+}
+
+/****
+*
+* pcg_solver class functions
+*
+****/
+
+pcg_solver::pcg_solver(pcg_precond p, double _tol, int _max_iter) {
+    precond = p;
+    tol = _tol;
+    max_iter = _max_iter;
+    iterations[X] = iterations[Y] = 0;
+    residual[X] = residual[Y] = 0.;
+}
+
+void pcg_solver::factor(solver_matrix* Q) {
+    inv_diag.assign(Q->n, 1.);
+    for(int j = 0; j < Q->n; ++j) {
+        for(int p = Q->Ap[j]; p < Q->Ap[j+1]; ++p) {
+            if (Q->Ai[p] == j && Q->Ax[p] != 0.)
+                inv_diag[j] = 1./Q->Ax[p];
+        }
+    }
+
+    if (precond == ICHOL)
+        factor_ichol(Q);
+}
+
+// IC(0): cholesky restricted to the lower triangle pattern of Q
+void pcg_solver::factor_ichol(solver_matrix* Q) {
+    int n = Q->n;
+    Lp.assign(1, 0);
+    Li.clear();
+    Lx.clear();
+    for(int j = 0; j < n; ++j) {
+        for(int p = Q->Ap[j]; p < Q->Ap[j+1]; ++p) {
+            if (Q->Ai[p] >= j) {
+                Li.push_back(Q->Ai[p]);
+                Lx.push_back(Q->Ax[p]);
+            }
+        }
+        Lp.push_back(Li.size());
+    }
+
+    vector<int> pos(n, -1);
+    int n_shifted = 0;
+    for(int k = 0; k < n; ++k) {
+        int d = Lp[k];
+        // a non-positive pivot (e.g. a component with no fixed cells)
+        // falls back to the jacobi scaling for that column
+        if (Lx[d] <= 1e-12 * (1./inv_diag[k])) {
+            Lx[d] = 1./inv_diag[k];
+            ++n_shifted;
+        }
+        Lx[d] = sqrt(Lx[d]);
+        for(int p = d+1; p < Lp[k+1]; ++p)
+            Lx[p] /= Lx[d];
+
+        // update the columns to the right, dropping any fill-in
+        for(int p = d+1; p < Lp[k+1]; ++p) {
+            int i = Li[p];
+            for(int q = Lp[i]; q < Lp[i+1]; ++q)
+                pos[Li[q]] = q;
+            for(int q = p; q < Lp[k+1]; ++q) {
+                if (pos[Li[q]] >= 0)
+                    Lx[pos[Li[q]]] -= Lx[q]*Lx[p];
+            }
+            for(int q = Lp[i]; q < Lp[i+1]; ++q)
+                pos[Li[q]] = -1;
+        }
+    }
+
+    if (n_shifted > 0)
+        spdlog::warn("ichol: {} non-positive pivots replaced by the diagonal", n_shifted);
+}
+
+void pcg_solver::apply_precond(const vector<double>& r, vector<double>& z) {
+    int n = r.size();
+    if (precond == JACOBI) {
+        for(int i = 0; i < n; ++i)
+            z[i] = r[i]*inv_diag[i];
+        return;
+    }
+
+    // L y = r
+    z = r;
+    for(int j = 0; j < n; ++j) {
+        z[j] /= Lx[Lp[j]];
+        for(int p = Lp[j]+1; p < Lp[j+1]; ++p)
+            z[Li[p]] -= Lx[p]*z[j];
+    }
+    // L^T z = y
+    for(int j = n-1; j >= 0; --j) {
+        for(int p = Lp[j]+1; p < Lp[j+1]; ++p)
+            z[j] -= Lx[p]*z[Li[p]];
+        z[j] /= Lx[Lp[j]];
+    }
+}
+
+void pcg_solver::solve(solver_matrix* Q, enum axis ax, double* x) {
+    int n = Q->n;
+    double* b = Q->get_C_ss(ax);
+    vector<double> r(n), z(n), p(n), q(n);
+
+    solver_matrix_multiply(Q, x, &q[0]);
+    for(int i = 0; i < n; ++i)
+        r[i] = b[i] - q[i];
+
+    double bnorm = 0.;
+    for(int i = 0; i < n; ++i)
+        bnorm += b[i]*b[i];
+    bnorm = sqrt(bnorm);
+    if (bnorm == 0.)
+        bnorm = 1.;
+
+    apply_precond(r, z);
+    p = z;
+    double rz = dot(r, z);
+    double rnorm = sqrt(dot(r, r));
+
+    int it = 0;
+    while (it < max_iter && rnorm > tol*bnorm) {
+        solver_matrix_multiply(Q, &p[0], &q[0]);
+        double pq = dot(p, q);
+        if (pq <= 0.)
+            break;
+        double alpha = rz/pq;
+        for(int i = 0; i < n; ++i) {
+            x[i] += alpha*p[i];
+            r[i] -= alpha*q[i];
+        }
+        rnorm = sqrt(dot(r, r));
+
+        apply_precond(r, z);
+        double rz_next = dot(r, z);
+        double beta = rz_next/rz;
+        rz = rz_next;
+        for(int i = 0; i < n; ++i)
+            p[i] = z[i] + beta*p[i];
+        ++it;
+    }
+
+    iterations[ax] = it;
+    residual[ax] = rnorm/bnorm;
+    if (rnorm > tol*bnorm)
+        spdlog::warn("pcg {}: no convergence after {} iterations, relative residual {}", ax == X ? "x" : "y", it, residual[ax]);
+    else
+        spdlog::info("pcg {}: {} iterations, relative residual {}", ax == X ? "x" : "y", it, residual[ax]);
+}
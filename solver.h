@@ -0,0 +1,82 @@
+#ifndef __SOLVER_H__
+#define __SOLVER_H__
+#include <vector>
+#include <string>
+#include "circuit.h"
+
+using namespace std;
+
+struct solver_matrix;
+
+// linear solver for the placement system Q x = C
+class solver {
+    public:
+        virtual ~solver() {}
+        // called once per rebuilt Q, before solving for either axis
+        virtual void factor(solver_matrix* Q) = 0;
+        // x holds the previous solution on entry, which iterative solvers
+        // use as a warm start. may be called for both axes concurrently
+        virtual void solve(solver_matrix* Q, enum axis ax, double* x) = 0;
+        virtual string name() = 0;
+};
+
+// a symbolic analysis and the sparsity pattern it was done for
+struct umfpack_symbolic {
+    void* Symbolic;
+    vector<int> Ap;
+    vector<int> Ai;
+};
+
+class umfpack_solver : public solver {
+    private:
+        // symbolic analyses are kept while their pattern comes back, most
+        // recently used first. B2B factors a different X and Y matrix each
+        // iteration, so there is room for one per axis
+        static const int max_symbolic = 2;
+        vector<umfpack_symbolic> symbolics;
+        void* Numeric;
+        void* get_symbolic(solver_matrix* Q);
+        void free_factorization();
+    public:
+        umfpack_solver();
+        ~umfpack_solver();
+        void factor(solver_matrix* Q);
+        void solve(solver_matrix* Q, enum axis ax, double* x);
+        string name() { return "umfpack"; }
+};
+
+enum pcg_precond {
+    JACOBI,
+    ICHOL
+};
+
+class pcg_solver : public solver {
+    private:
+        pcg_precond precond;
+        double tol;
+        int max_iter;
+
+        // jacobi: inverse of the diagonal
+        vector<double> inv_diag;
+        // ichol: zero fill-in cholesky factor L, lower triangle in CSC
+        // with the diagonal first in each column
+        vector<int> Lp;
+        vector<int> Li;
+        vector<double> Lx;
+
+        void factor_ichol(solver_matrix* Q);
+        void apply_precond(const vector<double>& r, vector<double>& z);
+    public:
+        pcg_solver(pcg_precond p = JACOBI, double _tol = 1e-8, int _max_iter = 1000);
+        void factor(solver_matrix* Q);
+        void solve(solver_matrix* Q, enum axis ax, double* x);
+        string name() { return "pcg"; }
+
+        // stats of the last solve, per axis
+        int iterations[2];
+        double residual[2];
+};
+
+void solver_matrix_multiply(solver_matrix* Q, const double* x, double* y);
+
+#endif
@@ -0,0 +1,77 @@
+#include <gtest/gtest.h>
+#include <vector>
+#include <utility>
+#include <math.h>
+#include "circuit.h"
+#include "solver.h"
+
+// 0 - 1 - 2 - 3 - 4, with 0 fixed at (0,0) and 4 fixed at (1,1)
+static void check_chain(circuit* circ) {
+    double expected[] = {0.25, 0.5, 0.75};
+    for (int i = 1; i <= 3; ++i) {
+        pair<double,double> coords = circ->get_cell(to_string(i))->get_coords();
+        ASSERT_NEAR(get<0>(coords), expected[i-1], 1e-8);
+        ASSERT_NEAR(get<1>(coords), expected[i-1], 1e-8);
+    }
+}
+
+static double relative_residual(solver_matrix* Q, enum axis ax, vector<double>& x) {
+    vector<double> q(Q->n);
+    solver_matrix_multiply(Q, &x[0], &q[0]);
+    double* b = Q->get_C_ss(ax);
+    double rr = 0., bb = 0.;
+    for (int i = 0; i < Q->n; ++i) {
+        rr += (b[i]-q[i])*(b[i]-q[i]);
+        bb += b[i]*b[i];
+    }
+    return sqrt(rr/bb);
+}
+
+TEST(Solver, pcg_jacobi_chain) {
+    circuit* circ = new circuit("../data/cct_inspect_csc");
+    circ->set_solver(new pcg_solver(JACOBI, 1e-12));
+    circ->iter();
+    check_chain(circ);
+    delete circ;
+}
+
+TEST(Solver, pcg_ichol_chain) {
+    circuit* circ = new circuit("../data/cct_inspect_csc");
+    pcg_solver* pcg = new pcg_solver(ICHOL, 1e-12);
+    circ->set_solver(pcg);
+    circ->iter();
+    check_chain(circ);
+
+    // a tridiagonal matrix has no fill-in, so IC(0) is the exact factor
+    ASSERT_LE(pcg->iterations[X], 1);
+    ASSERT_LE(pcg->iterations[Y], 1);
+    delete circ;
+}
+
+TEST(Solver, pcg_cct3_preconditioners) {
+    int iters[2];
+    pcg_precond preconds[] = {JACOBI, ICHOL};
+    for (int k = 0; k < 2; ++k) {
+        circuit* circ = new circuit("../data/cct3");
+        circ->set_fixed_weight_bias(0.1);
+        pcg_solver* pcg = new pcg_solver(preconds[k], 1e-10, 5000);
+        circ->set_solver(pcg);
+        circ->iter();
+
+        solver_matrix* Q = circ->get_solver_matrix();
+        vector<double> x;
+        for (auto* c : circ->get_cells()) {
+            if (!c->is_fixed())
+                x.push_back(get<0>(c->get_coords()));
+        }
+        ASSERT_LT(relative_residual(Q, X, x), 1e-9);
+        ASSERT_LE(pcg->residual[X], 1e-10);
+        iters[k] = pcg->iterations[X];
+
+        // warm started from the converged solution, nothing left to do
+        circ->iter();
+        ASSERT_EQ(pcg->iterations[X], 0);
+        delete circ;
+    }
+    ASSERT_LT(iters[1], iters[0]);
+}
@@ -16,7 +16,7 @@ void ui_drawscreen();
 void ui_click_handler (float x, float y);
 void ui_mouse_handler (float x, float y);
 void ui_key_handler(char c);
-void ui_draw_bin__path(vector<bin*> b);
+void ui_draw_bin__path(bin** begin, bin** end);
 
 float logic_cell_width = 10.0;
 
@@ -78,7 +78,7 @@ void ui_init(circuit* circuit, fabric* fabric, flow_state* flow_state) {
     create_button("SPEED 0x","SPEED 1x", ui_speed_1x);
     create_button("SPEED 1x","SPEED .1x", ui_speed_p1x);
     create_button("SPEED .1x","SPEED .01x", ui_speed_p01x);
-    init_world(-1.,26.,26.,-1.);
+    init_world(-1., fab->get_height()+1., fab->get_width()+1., -1.);
     set_keypress_input(true);
     //set_mouse_move_input(true);
 
@@ -124,20 +124,13 @@ void ui_key_handler(char c) {
 }
 
 void ui_draw_fs(flow_state* fs) {
-    for(auto& path : fs->P) {
-        queue<bin*> pc = queue<bin*>(path);
-        vector<bin*> p;
-        while(pc.empty()==false) {
-            bin* b = pc.front(); pc.pop();
-            p.push_back(b);
-        }
-        ui_draw_bin__path(p);
+    for(int k = 0; k < fs->P.size(); ++k) {
+        ui_draw_bin__path(fs->P.begin(k), fs->P.end(k));
     }
 }
 
 void ui_draw_cell_fn(circuit* circ, cell* c) {
     double width = 1.;
-    double height = width;
     // center at the cells coords
     pair<double,double> p = c->get_coords();
     double x = get<0>(p);
@@ -174,11 +167,12 @@ void ui_draw_net_fn(circuit* circ, net* n) {
     }
 }
 
-void ui_draw_bin__path(vector<bin*> b) {
+void ui_draw_bin__path(bin** begin, bin** end) {
     setcolor(RED);
     int i = 0;
     char label[32] = {0};
-    for(auto& bi : b) {
+    for(bin** it = begin; it != end; ++it) {
+        bin* bi = *it;
         double width = 1.;
         double height = width;
         // center at the cells coords
@@ -208,7 +202,7 @@ void ui_draw_bin_fn(bin* b) {
     if (b->supply() > 0) {
         setcolor(BLACK);
         char buff[32] = {'\0'};
-        snprintf(buff,32,"%d",b->supply());
+        snprintf(buff,32,"%g",b->supply());
         drawtext(x, y, buff, 10.0);
     }
 }